@@ -0,0 +1,101 @@
+/*******************************************************************************
+The MIT License (MIT)
+
+Copyright (c) 2015 Dmitry "Dima" Korolev <dmitry.korolev@gmail.com>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*******************************************************************************/
+
+// Shared by the `bench_*.cc` micro-benchmarks, built and run via `make bench`: the timing loop, and the sample
+// events. Build with `NDEBUG=1` for representative numbers.
+
+#ifndef BENCH_H
+#define BENCH_H
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "types.h"
+
+// Calls `f()` `n` times, after one warm-up call, and returns the nanoseconds per call.
+// `f` should keep its result observable, for instance by adding it to a checksum, not to be optimized away.
+template <typename F>
+double NanosecondsPerCall(size_t n, F&& f) {
+  f();
+  const auto begin = std::chrono::steady_clock::now();
+  for (size_t i = 0; i < n; ++i) {
+    f();
+  }
+  const auto end = std::chrono::steady_clock::now();
+  return std::chrono::duration<double, std::nano>(end - begin).count() / std::max(n, static_cast<size_t>(1));
+}
+
+// Prints one line of the results: the time per call, and how many times faster it is than the baseline.
+inline void ReportNanosecondsPerCall(const std::string& name, double ns, double baseline_ns) {
+  std::printf("%-48s %12.1f ns %8.2fx\n", name.c_str(), ns, baseline_ns / ns);
+}
+
+// One event of each type, with the fields filled in to typical sizes.
+inline std::vector<std::unique_ptr<MidichloriansEvent>> SampleMidichloriansEvents() {
+  std::vector<std::unique_ptr<MidichloriansEvent>> events;
+  events.emplace_back(new iOSIdentifyEvent());
+  {
+    std::unique_ptr<iOSDeviceInfo> e(new iOSDeviceInfo());
+    e->info["deviceModel"] = "iPhone7,2";
+    e->info["deviceName"] = "Unnamed";
+    e->info["systemVersion"] = "9.1";
+    e->info["appVersion"] = "1.4.2";
+    events.emplace_back(std::move(e));
+  }
+  {
+    std::unique_ptr<iOSAppLaunchEvent> e(new iOSAppLaunchEvent());
+    e->binary_version = "1.4.2 (1042)";
+    events.emplace_back(std::move(e));
+  }
+  events.emplace_back(new iOSFirstLaunchEvent());
+  {
+    std::unique_ptr<iOSFocusEvent> e(new iOSFocusEvent());
+    e->gained_focus = true;
+    events.emplace_back(std::move(e));
+  }
+  {
+    std::unique_ptr<iOSGenericEvent> e(new iOSGenericEvent());
+    e->event = "Screen Shown";
+    e->source = "SettingsViewController";
+    e->fields["screen"] = "settings";
+    e->fields["previous_screen"] = "main";
+    events.emplace_back(std::move(e));
+  }
+  {
+    std::unique_ptr<iOSBaseEvent> e(new iOSBaseEvent());
+    e->description = "Unrecognized event, kept as is.";
+    events.emplace_back(std::move(e));
+  }
+  for (auto& e : events) {
+    e->device_id = "A1B2C3D4-E5F6-4A5B-8C9D-0E1F2A3B4C5D";
+    e->client_id = "client";
+  }
+  return events;
+}
+
+#endif  // BENCH_H
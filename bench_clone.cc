@@ -0,0 +1,66 @@
+/*******************************************************************************
+The MIT License (MIT)
+
+Copyright (c) 2015 Dmitry "Dima" Korolev <dmitry.korolev@gmail.com>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*******************************************************************************/
+
+// Micro-benchmark: `ClonePolymorphic()`, the copy constructor of the exact type of the event, against the JSON
+// round-trip of `CloneSerializable()` it replaced, for the copies of `EventWithTimestamp`, see `types.h`.
+
+#include <memory>
+#include <vector>
+
+#include "bench.h"
+#include "helpers.h"
+#include "types.h"
+
+#include "../Current/Bricks/dflags/dflags.h"
+
+DEFINE_int32(n, 100000, "The number of times to clone each sample event.");
+
+int main(int argc, char** argv) {
+  ParseDFlags(&argc, &argv);
+  const size_t n = static_cast<size_t>(std::max(FLAGS_n, 1));
+  const std::vector<std::unique_ptr<MidichloriansEvent>> events = SampleMidichloriansEvents();
+
+  size_t checksum = 0;
+  double total_json_ns = 0;
+  double total_clone_ns = 0;
+  for (const auto& e : events) {
+    const double json_ns = NanosecondsPerCall(n, [&e, &checksum]() {
+      checksum += CloneSerializable(e)->device_id.length();
+    });
+    const double clone_ns = NanosecondsPerCall(n, [&e, &checksum]() {
+      checksum += ClonePolymorphic<MIDICHLORIAN_EVENT_TYPES>(e)->device_id.length();
+    });
+    const EventWithTimestamp<MidichloriansEvent> entry(0, ClonePolymorphic<MIDICHLORIAN_EVENT_TYPES>(e));
+    const std::string description = entry.Description();
+    const std::string name = description.substr(0, description.find_first_of(",:"));
+    ReportNanosecondsPerCall(name + ", JSON round-trip", json_ns, json_ns);
+    ReportNanosecondsPerCall(name + ", ClonePolymorphic", clone_ns, json_ns);
+    total_json_ns += json_ns;
+    total_clone_ns += clone_ns;
+  }
+  const double average_json_ns = total_json_ns / events.size();
+  ReportNanosecondsPerCall("Average, JSON round-trip", average_json_ns, average_json_ns);
+  ReportNanosecondsPerCall("Average, ClonePolymorphic", total_clone_ns / events.size(), average_json_ns);
+  std::printf("Checksum: %zu\n", checksum);
+}
@@ -0,0 +1,89 @@
+/*******************************************************************************
+The MIT License (MIT)
+
+Copyright (c) 2015 Dmitry "Dima" Korolev <dmitry.korolev@gmail.com>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*******************************************************************************/
+
+// Micro-benchmark: dispatching events to a visitor by their exact type, see `dispatch.h`.
+// 1) `RTTIDynamicCall`, which resolves the type on every call, as before.
+// 2) `TypeIndex` followed by `DispatchByTypeIndex`, which resolves the type via a hash map on every call.
+// 3) `DispatchByTypeIndex` with the index resolved once per event, as `EventWithTimestamp` keeps it.
+
+#include <memory>
+#include <vector>
+
+#include "bench.h"
+#include "dispatch.h"
+#include "helpers.h"
+#include "types.h"
+
+#include "../Current/Bricks/dflags/dflags.h"
+#include "../Current/Bricks/template/metaprogramming.h"
+
+DEFINE_int32(n, 10000000, "The number of events to dispatch, per method.");
+DEFINE_int32(mix, 4096, "The number of sample events, of random types, to dispatch in turn.");
+
+// Does a little bit of type-dependent work, like the feature extraction does.
+struct Visitor {
+  size_t checksum = 0;
+  template <typename T>
+  void operator()(const T& e) {
+    checksum += e.device_id.length() + IndexInTuple<T, MIDICHLORIAN_EVENT_TYPES>::value;
+  }
+};
+
+int main(int argc, char** argv) {
+  ParseDFlags(&argc, &argv);
+  const size_t n = static_cast<size_t>(std::max(FLAGS_n, 1));
+  const std::vector<std::unique_ptr<MidichloriansEvent>> samples = SampleMidichloriansEvents();
+
+  // A fixed pseudo-random mix of types, so that the branch predictor can not learn the order.
+  std::vector<const MidichloriansEvent*> events;
+  std::vector<size_t> type_indexes;
+  uint64_t random = 42;
+  for (size_t i = 0; i < static_cast<size_t>(std::max(FLAGS_mix, 1)); ++i) {
+    random = random * 6364136223846793005ull + 1442695040888963407ull;
+    const MidichloriansEvent& e = *samples[(random >> 33) % samples.size()];
+    events.push_back(&e);
+    type_indexes.push_back(TypeIndex<MIDICHLORIAN_EVENT_TYPES>(e));
+  }
+
+  Visitor visitor;
+  size_t i = 0;
+  const double rtti_ns = NanosecondsPerCall(n, [&]() {
+    bricks::metaprogramming::RTTIDynamicCall<MIDICHLORIAN_EVENT_TYPES>(*events[i], visitor);
+    i = (i + 1 == events.size()) ? 0 : i + 1;
+  });
+  const double type_index_ns = NanosecondsPerCall(n, [&]() {
+    const MidichloriansEvent& e = *events[i];
+    DispatchByTypeIndex<MIDICHLORIAN_EVENT_TYPES>(TypeIndex<MIDICHLORIAN_EVENT_TYPES>(e), e, visitor);
+    i = (i + 1 == events.size()) ? 0 : i + 1;
+  });
+  const double jump_table_ns = NanosecondsPerCall(n, [&]() {
+    DispatchByTypeIndex<MIDICHLORIAN_EVENT_TYPES>(type_indexes[i], *events[i], visitor);
+    i = (i + 1 == events.size()) ? 0 : i + 1;
+  });
+
+  ReportNanosecondsPerCall("RTTIDynamicCall", rtti_ns, rtti_ns);
+  ReportNanosecondsPerCall("TypeIndex + DispatchByTypeIndex", type_index_ns, rtti_ns);
+  ReportNanosecondsPerCall("DispatchByTypeIndex, index kept", jump_table_ns, rtti_ns);
+  std::printf("Checksum: %zu\n", visitor.checksum);
+}
@@ -0,0 +1,142 @@
+/*******************************************************************************
+The MIT License (MIT)
+
+Copyright (c) 2015 Dmitry "Dima" Korolev <dmitry.korolev@gmail.com>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*******************************************************************************/
+
+// Benchmark: searching the index while it is being written to at full speed, as during a replay of the log.
+// One writer indexes the events, the way `v2` does, as fast as it can. Meanwhile, the readers run a mix of
+// exact, prefix, and substring queries, and a prober measures how long it takes for the latest event indexed
+// to become searchable.
+
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+
+#include "bench.h"
+#include "dispatch.h"
+#include "search_index.h"
+
+#include "../Current/Bricks/dflags/dflags.h"
+#include "../Current/Bricks/strings/printf.h"
+#include "../Current/Bricks/strings/util.h"
+
+DEFINE_int32(n, 200000, "The number of events to index.");
+DEFINE_int32(readers, 4, "The number of threads to run search queries on.");
+DEFINE_int32(groups, 10000, "The number of distinct groups, devices, the events are spread across.");
+
+int main(int argc, char** argv) {
+  ParseDFlags(&argc, &argv);
+  const size_t n = static_cast<size_t>(std::max(FLAGS_n, 1));
+  const size_t groups = static_cast<size_t>(std::max(FLAGS_groups, 1));
+  const std::vector<std::unique_ptr<MidichloriansEvent>> samples = SampleMidichloriansEvents();
+  const uint64_t base_ms = 1420000000000ull;
+
+  SearchIndex index;
+  index.EnableSubstringSearch();
+
+  std::atomic_size_t indexed(0);
+  std::atomic_bool done(false);
+
+  std::vector<size_t> queries(static_cast<size_t>(std::max(FLAGS_readers, 0)));
+  std::vector<std::thread> readers;
+  for (size_t r = 0; r < queries.size(); ++r) {
+    readers.emplace_back([&index, &done, &queries, r]() {
+      const std::vector<std::string> mix = {"settings", "screen shown", "iphone*", "*ttingsview*", "cid*"};
+      size_t i = r;
+      while (!done) {
+        index.Search(mix[i % mix.size()], 10);
+        ++i;
+        ++queries[r];
+      }
+    });
+  }
+
+  // The time from an event being indexed to it being found by its timestamp, which is one of its terms.
+  double total_lag_ms = 0;
+  double max_lag_ms = 0;
+  size_t probes = 0;
+  std::thread prober([&index, &done, &indexed, &total_lag_ms, &max_lag_ms, &probes, base_ms]() {
+    size_t probed = 0;
+    while (!done) {
+      const size_t latest = indexed;
+      if (latest == probed) {
+        std::this_thread::yield();
+        continue;
+      }
+      probed = latest;
+      const std::string term = bricks::strings::ToString(base_ms + latest - 1);
+      const auto begin = std::chrono::steady_clock::now();
+      while (!done && index.Search(term, 1).uris.empty()) {
+        std::this_thread::sleep_for(std::chrono::microseconds(100));
+      }
+      if (!done) {
+        const double lag_ms =
+            std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - begin).count();
+        total_lag_ms += lag_ms;
+        max_lag_ms = std::max(max_lag_ms, lag_ms);
+        ++probes;
+      }
+    }
+  });
+
+  const auto begin = std::chrono::steady_clock::now();
+  for (size_t i = 0; i < n; ++i) {
+    const MidichloriansEvent& e = *samples[i % samples.size()];
+    const uint64_t ms = base_ms + i;
+    const std::string gid = bricks::strings::Printf("CID:%zu", i % groups);
+    const std::vector<std::string> values = {"/g?gid=" + gid,
+                                             bricks::strings::Printf("/e?eid=%llu", ms * 1000)};
+    SearchIndex::Batch batch;
+    for (const auto& rhs : values) {
+      SearchIndex::Populator populator(batch, rhs);
+      DispatchByTypeIndex<MIDICHLORIAN_EVENT_TYPES>(TypeIndex<MIDICHLORIAN_EVENT_TYPES>(e), e, populator);
+      batch.AddToIndex(gid, rhs);
+      batch.AddToIndex(bricks::strings::ToString(ms), rhs);
+      for (const auto& lhs : values) {
+        batch.AddToIndex(lhs, rhs);
+      }
+    }
+    index.Add(std::move(batch));
+    indexed = i + 1;
+  }
+  const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+  done = true;
+  for (auto& reader : readers) {
+    reader.join();
+  }
+  prober.join();
+
+  size_t total_queries = 0;
+  for (const size_t count : queries) {
+    total_queries += count;
+  }
+  std::printf("Indexed %zu events in %.2f s, %.0f events per second.\n", n, seconds, n / seconds);
+  std::printf("%zu readers ran %zu queries, %.0f queries per second.\n",
+              queries.size(),
+              total_queries,
+              total_queries / seconds);
+  std::printf("Searchable after %.1f ms on average, %.1f ms at most, over %zu probes.\n",
+              probes ? total_lag_ms / probes : 0.0,
+              max_lag_ms,
+              probes);
+}
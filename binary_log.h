@@ -0,0 +1,178 @@
+/*******************************************************************************
+The MIT License (MIT)
+
+Copyright (c) 2015 Dmitry "Dima" Korolev <dmitry.korolev@gmail.com>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*******************************************************************************/
+
+// Binary event log: a compact, replay-friendly alternative to the JSON log lines.
+//
+// Format: the "MIDIBIN1" magic, followed by records, each prefixed by its varint length. A record is:
+// 1) The varint type tag: 0 for a tick, or 1 + the index of the type of the event in `TYPES`.
+// 2) The zigzag varint delta of the millisecond timestamp from the one of the previous record.
+// 3) For events, the event itself, in the compact binary archive format, with strings interned across records.
+//
+// Records must be read in the order they were written, as the string table is built along the way.
+
+#ifndef BINARY_LOG_H
+#define BINARY_LOG_H
+
+#include <memory>
+#include <ostream>
+#include <string>
+#include <tuple>
+
+#include "compact_archive.h"
+#include "dispatch.h"
+#include "helpers.h"
+#include "log_input.h"
+
+#include "../Current/Bricks/template/metaprogramming.h"
+
+const char kBinaryEventLogMagic[] = "MIDIBIN1";
+const size_t kBinaryEventLogMagicLength = 8;
+
+template <typename BASE, typename TYPES>
+class BinaryEventLogWriter {
+ public:
+  explicit BinaryEventLogWriter(std::ostream& os) : os_(os) {
+    os_.write(kBinaryEventLogMagic, kBinaryEventLogMagicLength);
+  }
+
+  void WriteTick(uint64_t ms) {
+    record_.clear();
+    AppendVarInt(0, record_);
+    AppendTimestamp(ms);
+    Flush();
+  }
+
+  void WriteEvent(uint64_t ms, const BASE& e) {
+    record_.clear();
+    EventWriter writer(*this, ms);
+    if (!DispatchByTypeIndex<TYPES>(TypeIndex<TYPES>(e), e, writer)) {
+      bricks::metaprogramming::RTTIDynamicCall<TYPES>(e, writer);
+    }
+    Flush();
+  }
+
+ private:
+  struct EventWriter {
+    BinaryEventLogWriter& self;
+    const uint64_t ms;
+    EventWriter(BinaryEventLogWriter& self, uint64_t ms) : self(self), ms(ms) {}
+    template <typename T>
+    void operator()(const T& e) {
+      AppendVarInt(1 + IndexInTuple<T, TYPES>::value, self.record_);
+      self.AppendTimestamp(ms);
+      SaveCompact(e, self.record_, self.strings_);
+    }
+  };
+
+  void AppendTimestamp(uint64_t ms) {
+    AppendVarInt(ZigZagEncode(static_cast<int64_t>(ms - last_ms_)), record_);
+    last_ms_ = ms;
+  }
+
+  void Flush() {
+    header_.clear();
+    AppendVarInt(record_.length(), header_);
+    os_.write(header_.data(), header_.length());
+    os_.write(record_.data(), record_.length());
+  }
+
+  std::ostream& os_;
+  CompactStringTable strings_;
+  uint64_t last_ms_ = 0;
+  std::string header_;
+  std::string record_;
+};
+
+template <typename BASE, typename TYPES>
+class BinaryEventLogReader {
+ public:
+  explicit BinaryEventLogReader(const std::string& file_name)
+      : file_(file_name), p_(file_.Data()), end_(file_.Data() + file_.Size()) {
+    if (file_.Size() < kBinaryEventLogMagicLength ||
+        std::memcmp(p_, kBinaryEventLogMagic, kBinaryEventLogMagicLength)) {
+      throw std::runtime_error("`" + file_name + "` is not a binary event log.");
+    }
+    p_ += kBinaryEventLogMagicLength;
+  }
+
+  // Reads the next record. Returns false at the end of the log. `e` is set to `nullptr` for ticks.
+  // Throws `CompactArchiveException` if the log is corrupted.
+  bool Read(uint64_t& ms, std::unique_ptr<BASE>& e) {
+    if (p_ == end_) {
+      return false;
+    }
+    const uint64_t length = ReadVarInt(p_, end_);
+    if (static_cast<uint64_t>(end_ - p_) < length) {
+      throw CompactArchiveException();
+    }
+    const char* record = p_;
+    const char* const record_end = p_ + length;
+    p_ = record_end;
+    const uint64_t tag = ReadVarInt(record, record_end);
+    last_ms_ += static_cast<uint64_t>(ZigZagDecode(ReadVarInt(record, record_end)));
+    ms = last_ms_;
+    if (!tag) {
+      e = nullptr;
+    } else {
+      e = Loader<0>::Load(static_cast<size_t>(tag - 1), record, record_end, strings_);
+    }
+    return true;
+  }
+
+  // The number of bytes consumed so far, for progress reporting.
+  size_t Offset() const { return static_cast<size_t>(p_ - file_.Data()); }
+
+ private:
+  template <size_t I, bool END = (I == std::tuple_size<TYPES>::value)>
+  struct Loader {
+    static std::unique_ptr<BASE> Load(size_t index,
+                                      const char* begin,
+                                      const char* end,
+                                      CompactStringTable& strings) {
+      if (index == I) {
+        typedef typename std::tuple_element<I, TYPES>::type T;
+        std::unique_ptr<T> e(new T());
+        LoadCompact(*e, begin, end, strings);
+        return std::unique_ptr<BASE>(e.release());
+      } else {
+        return Loader<I + 1>::Load(index, begin, end, strings);
+      }
+    }
+  };
+
+  template <size_t I>
+  struct Loader<I, true> {
+    static std::unique_ptr<BASE> Load(size_t, const char*, const char*, CompactStringTable&) {
+      throw CompactArchiveException();
+    }
+  };
+
+  const MemoryMappedFile file_;
+  const char* p_;
+  const char* const end_;
+  CompactStringTable strings_;
+  uint64_t last_ms_ = 0;
+};
+
+#endif  // BINARY_LOG_H
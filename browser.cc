@@ -23,6 +23,8 @@ SOFTWARE.
 *******************************************************************************/
 
 #include "helpers.h"
+#include "json_stream.h"
+#include "metrics.h"
 
 #include "insights.h"
 CEREAL_REGISTER_TYPE(insight::MutualInformation);
@@ -42,6 +44,7 @@ DEFINE_string(output_url_prefix, "http://localhost:3000", "The prefix for the UR
 
 DEFINE_string(input, "data/insights.json", "Path to the file containing the insights to browse.");
 DEFINE_string(id_key, "you_are_awesome", "The URL parameter name containing smart session token ID.");
+DEFINE_string(metrics_route, "/metrics", "The route to expose the latency histograms on.");
 
 using bricks::strings::Printf;
 using bricks::strings::FromString;
@@ -112,7 +115,7 @@ struct InsightResponse {
       assert(input.tag.find(cit->second.tag) != input.tag.end());
     });
     description = input.insight[index]->Description();
-    insight = CloneSerializable(input.insight[index]);
+    insight = ClonePolymorphic<INSIGHT_TYPES>(input.insight[index]);
   }
   template <typename A>
   void serialize(A& ar) {
@@ -267,7 +270,9 @@ int main(int argc, char** argv) {
 
   const auto input = ParseJSON<InsightsOutput>(FileSystem::ReadFileAsString(FLAGS_input));
 
-  HTTP(FLAGS_port).Register(FLAGS_route, [&input](Request r) {
+  METRICS_HTTP_ROUTE(FLAGS_port, FLAGS_metrics_route);
+
+  RegisterTimed(HTTP(FLAGS_port), FLAGS_route, [&input](Request r) {
     const auto one_based_index = FromString<size_t>(r.url.query["id"]);
     if (one_based_index && one_based_index <= input.insight.size()) {
       if (!r.url.query["html"].empty()) {
@@ -299,7 +304,20 @@ int main(int argc, char** argv) {
     } else if (r.url.query["id"] == "all") {
       r(input.insight, "insights");
     } else if (r.url.query["id"] == "everything") {
-      r(input, "everything");
+      // Streamed, insight by insight, not to hold another copy of all of them, as JSON, in memory.
+      auto response = r.connection.SendChunkedHTTPResponse(
+          HTTPResponseCode.OK, "application/json; charset=utf-8", HTTPHeaders());
+      StreamingJSON json([&response](const std::string& chunk) { response.Send(chunk); });
+      json.BeginObject("everything");
+      json.Field("tag", input.tag);
+      json.Field("feature", input.feature);
+      json.BeginArray("insight");
+      for (const auto& insight : input.insight) {
+        json.Element(insight);
+      }
+      json.EndArray();
+      json.EndObject();
+      json.Finish();
     } else {
       r(TopLevelResponse(input.insight.size()));
     }
@@ -307,7 +325,7 @@ int main(int argc, char** argv) {
 
   WaitableAtomic<SmartSessionInfoMap> sessions;
 
-  HTTP(FLAGS_port).Register(FLAGS_route + "smart", [&input, &sessions](Request r) {
+  RegisterTimed(HTTP(FLAGS_port), FLAGS_route + "smart", [&input, &sessions](Request r) {
     const bool as_html = !r.url.query["html"].empty();
     const std::string& id = r.url.query[FLAGS_id_key];
     const std::string& action = r.url.query["action"];
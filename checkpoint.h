@@ -0,0 +1,330 @@
+/*******************************************************************************
+The MIT License (MIT)
+
+Copyright (c) 2015 Dmitry "Dima" Korolev <dmitry.korolev@gmail.com>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*******************************************************************************/
+
+// Checkpoints: a snapshot, and an append-only log, of objects in the compact binary format.
+//
+// The snapshot is a sequence of objects sharing one string table. It is written into a temporary file as it is
+// serialized, and the file is then renamed, so that a crash while writing it leaves the previous snapshot
+// intact. Objects are read back in the same order they were written in.
+//
+// The log holds what only grows, so that each checkpoint only appends what is new since the previous one. It is
+// a sequence of records, each prefixed by its length, and each with a string table of its own. The snapshot
+// keeps the size of the log as of when it was taken: the records past it, appended for a checkpoint that has
+// not completed, are dropped.
+//
+// Polymorphic objects are written as the index of their exact type in the type list, followed by the object.
+
+#ifndef CHECKPOINT_H
+#define CHECKPOINT_H
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <tuple>
+
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "compact_archive.h"
+#include "dispatch.h"
+#include "helpers.h"
+#include "log_input.h"
+
+#include "../Current/Bricks/template/metaprogramming.h"
+
+const char kCheckpointMagic[] = "MIDICKP6";
+const char kCheckpointLogMagic[] = "MIDICKL1";
+const size_t kCheckpointMagicLength = 8;
+
+inline bool FileExists(const std::string& file_name) {
+  struct stat info;
+  return ::stat(file_name.c_str(), &info) == 0;
+}
+
+// Writes objects into a buffer, sharing one string table.
+class CheckpointRecordWriter {
+ public:
+  CheckpointRecordWriter() : ar_(data_, strings_) {}
+
+  template <typename T>
+  void Write(const T& object) {
+    ar_(object);
+  }
+
+  template <typename TYPES, typename BASE>
+  void WritePolymorphic(const BASE& object) {
+    PolymorphicWriter<TYPES> writer(ar_);
+    if (!DispatchByTypeIndex<TYPES>(TypeIndex<TYPES>(object), object, writer)) {
+      bricks::metaprogramming::RTTIDynamicCall<TYPES>(object, writer);
+    }
+  }
+
+  // The bytes written so far. The caller may take them out, for the objects written next to be appended.
+  std::string& Data() { return data_; }
+  const std::string& Data() const { return data_; }
+
+ private:
+  template <typename TYPES>
+  struct PolymorphicWriter {
+    cereal::CompactBinaryOutputArchive& ar;
+    explicit PolymorphicWriter(cereal::CompactBinaryOutputArchive& ar) : ar(ar) {}
+    template <typename T>
+    void operator()(const T& object) {
+      ar(static_cast<uint64_t>(IndexInTuple<T, TYPES>::value), object);
+    }
+  };
+
+  std::string data_;
+  CompactStringTable strings_;
+  cereal::CompactBinaryOutputArchive ar_;
+};
+
+// Reads back the objects written by `CheckpointRecordWriter`, from [begin, end).
+// Throws `CompactArchiveException` if the data is corrupted.
+class CheckpointRecordReader {
+ public:
+  CheckpointRecordReader(const char* begin, const char* end) : ar_(begin, end, strings_) {}
+
+  template <typename T>
+  void Read(T& object) {
+    ar_(object);
+  }
+
+  template <typename TYPES, typename BASE>
+  std::unique_ptr<BASE> ReadPolymorphic() {
+    uint64_t index;
+    ar_(index);
+    return PolymorphicReader<TYPES, BASE>::Read(index, ar_);
+  }
+
+  // Throws if not all of the data has been read.
+  void Done() const {
+    if (!ar_.Done()) {
+      throw CompactArchiveException();
+    }
+  }
+
+ private:
+  template <typename TYPES, typename BASE, size_t I = 0, bool END = (I == std::tuple_size<TYPES>::value)>
+  struct PolymorphicReader {
+    static std::unique_ptr<BASE> Read(uint64_t index, cereal::CompactBinaryInputArchive& ar) {
+      if (index == I) {
+        typedef typename std::tuple_element<I, TYPES>::type T;
+        std::unique_ptr<T> object(new T());
+        ar(*object);
+        return std::unique_ptr<BASE>(object.release());
+      } else {
+        return PolymorphicReader<TYPES, BASE, I + 1>::Read(index, ar);
+      }
+    }
+  };
+
+  template <typename TYPES, typename BASE, size_t I>
+  struct PolymorphicReader<TYPES, BASE, I, true> {
+    static std::unique_ptr<BASE> Read(uint64_t, cereal::CompactBinaryInputArchive&) {
+      throw CompactArchiveException();
+    }
+  };
+
+  CompactStringTable strings_;
+  cereal::CompactBinaryInputArchive ar_;
+};
+
+// Writes the snapshot into `file_name`, replacing the previous one atomically on `Commit()`.
+// The objects are passed on to the file as they are written, for the snapshot not to be held in memory.
+// Throws `std::runtime_error` if the file can not be written.
+class CheckpointWriter {
+ public:
+  enum { kBufferSize = 1 << 20 };
+
+  explicit CheckpointWriter(const std::string& file_name)
+      : file_name_(file_name),
+        temporary_file_name_(file_name + ".tmp"),
+        fo_(temporary_file_name_, std::ios::binary | std::ios::trunc) {
+    if (!fo_) {
+      throw std::runtime_error("Can not open `" + temporary_file_name_ + "` for writing.");
+    }
+    fo_.write(kCheckpointMagic, kCheckpointMagicLength);
+    size_ = kCheckpointMagicLength;
+  }
+
+  template <typename T>
+  void Write(const T& object) {
+    writer_.Write(object);
+    FlushIfFull();
+  }
+
+  template <typename TYPES, typename BASE>
+  void WritePolymorphic(const BASE& object) {
+    writer_.WritePolymorphic<TYPES>(object);
+    FlushIfFull();
+  }
+
+  void Commit() {
+    Flush();
+    fo_.close();
+    if (!fo_) {
+      throw std::runtime_error("Can not write `" + temporary_file_name_ + "`.");
+    }
+    if (std::rename(temporary_file_name_.c_str(), file_name_.c_str())) {
+      throw std::runtime_error("Can not rename `" + temporary_file_name_ + "` into `" + file_name_ + "`: " +
+                               std::strerror(errno));
+    }
+  }
+
+  uint64_t Size() const { return size_ + writer_.Data().length(); }
+
+ private:
+  void FlushIfFull() {
+    if (writer_.Data().length() >= kBufferSize) {
+      Flush();
+    }
+  }
+
+  void Flush() {
+    std::string& data = writer_.Data();
+    fo_.write(data.data(), data.length());
+    if (!fo_) {
+      throw std::runtime_error("Can not write `" + temporary_file_name_ + "`.");
+    }
+    size_ += data.length();
+    data.clear();
+  }
+
+  const std::string file_name_;
+  const std::string temporary_file_name_;
+  std::ofstream fo_;
+  CheckpointRecordWriter writer_;
+  uint64_t size_;
+};
+
+// Throws `std::runtime_error` if the file can not be opened, and `CompactArchiveException` if it is corrupted.
+class CheckpointReader {
+ public:
+  explicit CheckpointReader(const std::string& file_name)
+      : file_(file_name), reader_(SkipMagic(file_, file_name), file_.Data() + file_.Size()) {}
+
+  template <typename T>
+  void Read(T& object) {
+    reader_.Read(object);
+  }
+
+  template <typename TYPES, typename BASE>
+  std::unique_ptr<BASE> ReadPolymorphic() {
+    return reader_.ReadPolymorphic<TYPES, BASE>();
+  }
+
+  // Throws if not all of the snapshot has been read.
+  void Done() const { reader_.Done(); }
+
+  size_t Size() const { return file_.Size(); }
+
+ private:
+  static const char* SkipMagic(const MemoryMappedFile& file, const std::string& file_name) {
+    if (file.Size() < kCheckpointMagicLength ||
+        std::memcmp(file.Data(), kCheckpointMagic, kCheckpointMagicLength)) {
+      throw std::runtime_error("`" + file_name + "` is not a checkpoint.");
+    }
+    return file.Data() + kCheckpointMagicLength;
+  }
+
+  const MemoryMappedFile file_;
+  CheckpointRecordReader reader_;
+};
+
+// Appends records to the log. Throws `std::runtime_error` if the log can not be written.
+class CheckpointLogWriter {
+ public:
+  // Opens the log to append to it past its first `size` bytes, as of the last snapshot, dropping the rest.
+  // Starts a new log if `size` is zero.
+  CheckpointLogWriter(const std::string& file_name, uint64_t size) : file_name_(file_name), size_(size) {
+    if (!size_) {
+      fo_.open(file_name_, std::ios::binary | std::ios::trunc);
+      fo_.write(kCheckpointLogMagic, kCheckpointMagicLength);
+      size_ = kCheckpointMagicLength;
+    } else {
+      if (::truncate(file_name_.c_str(), static_cast<off_t>(size_))) {
+        throw std::runtime_error("Can not truncate `" + file_name_ + "`: " + std::strerror(errno));
+      }
+      fo_.open(file_name_, std::ios::binary | std::ios::app);
+    }
+    if (!fo_) {
+      throw std::runtime_error("Can not open `" + file_name_ + "` for writing.");
+    }
+  }
+
+  void Append(const std::string& record) {
+    header_.clear();
+    AppendVarInt(record.length(), header_);
+    fo_.write(header_.data(), header_.length());
+    fo_.write(record.data(), record.length());
+    size_ += header_.length() + record.length();
+  }
+
+  // Makes sure the records appended so far are written, before the snapshot covering them is.
+  void Flush() {
+    fo_.flush();
+    if (!fo_) {
+      throw std::runtime_error("Can not write `" + file_name_ + "`.");
+    }
+  }
+
+  uint64_t Size() const { return size_; }
+
+ private:
+  const std::string file_name_;
+  std::ofstream fo_;
+  uint64_t size_;
+  std::string header_;
+};
+
+// Calls `f(record)`, with a `CheckpointRecordReader`, for each record in the first `size` bytes of the log.
+// Throws `std::runtime_error` if the log can not be opened or is shorter, and `CompactArchiveException` if it
+// is corrupted, or if not all of some record has been read by `f`.
+template <typename F>
+void ForEachCheckpointLogRecord(const std::string& file_name, uint64_t size, F&& f) {
+  const MemoryMappedFile file(file_name);
+  if (size < kCheckpointMagicLength || file.Size() < size ||
+      std::memcmp(file.Data(), kCheckpointLogMagic, kCheckpointMagicLength)) {
+    throw std::runtime_error("`" + file_name + "` does not match the checkpoint.");
+  }
+  const char* p = file.Data() + kCheckpointMagicLength;
+  const char* const end = file.Data() + size;
+  while (p != end) {
+    const uint64_t length = ReadVarInt(p, end);
+    if (static_cast<uint64_t>(end - p) < length) {
+      throw CompactArchiveException();
+    }
+    CheckpointRecordReader record(p, p + length);
+    f(record);
+    record.Done();
+    p += length;
+  }
+}
+
+#endif  // CHECKPOINT_H
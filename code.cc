@@ -24,8 +24,13 @@ SOFTWARE.
 
 #include <iostream>
 #include <algorithm>
+#include <iterator>
 
+#include "dispatch.h"
 #include "html.h"
+#include "log_entry_scanner.h"
+#include "log_input.h"
+#include "metrics.h"
 
 #include "../Bricks/mq/inmemory/mq.h"
 #include "../Bricks/template/metaprogramming.h"
@@ -41,6 +46,8 @@ SOFTWARE.
 
 DEFINE_int32(port, 8687, "Port to spawn the secret server on.");
 DEFINE_string(route, "/secret", "The route to serve the dashboard on.");
+DEFINE_string(input, "", "If set, read log entries from this file, plain or gzipped, instead of stdin.");
+DEFINE_string(metrics_route, "/metrics", "The route to expose the latency histograms on.");
 
 DEFINE_int32(initial_tick_wait_ms, 100, "");
 DEFINE_int32(tick_interval_ms, 2500, "");
@@ -90,7 +97,7 @@ struct State {
   uint64_t abscissa_max = static_cast<uint64_t>(0);
   std::map<std::string, std::map<uint64_t, size_t>> events;  // Histogram [event_name][abscissa] = count.
 
-  std::unordered_map<std::string, std::unordered_set<std::string>> reverse_index;  // search term -> [did].
+  std::map<std::string, std::unordered_set<std::string>> reverse_index;  // search term -> [did], sorted.
   std::unordered_map<std::string, Record> record;  // did -> info about this device.
 
   // did -> timestamp -> [event], ordered by timestamp.
@@ -110,11 +117,14 @@ struct State {
 };
 
 struct Message {
+  virtual ~Message() = default;
   virtual void Process(State&) = 0;
 };
 
 struct Tick : Message {
   virtual void Process(State& state) {
+    static LatencyMetric& tick_latency = Latency("ingestion", "tick");
+    const LatencyScope latency(tick_latency);
     // Dump intermediate counters and reset them between ticks.
     std::cout << "uptime=" << static_cast<uint64_t>(state.UptimeMs()) / 1000 << "s";
     auto& counters = state.counters_tick;
@@ -130,6 +140,7 @@ struct Tick : Message {
 struct Entry : Message {
   const uint64_t ms;
   const std::unique_ptr<MidichloriansEvent> entry;
+  const size_t type_index;  // Resolved by the parsing thread, in `T_TYPES` below.
   typedef std::tuple<iOSIdentifyEvent,
                      iOSDeviceInfo,
                      iOSAppLaunchEvent,
@@ -138,7 +149,8 @@ struct Entry : Message {
                      iOSGenericEvent,
                      iOSBaseEvent> T_TYPES;
   Entry() = delete;
-  Entry(uint64_t ms, std::unique_ptr<MidichloriansEvent>&& entry) : ms(ms), entry(std::move(entry)) {}
+  Entry(uint64_t ms, std::unique_ptr<MidichloriansEvent>&& entry)
+      : ms(ms), entry(std::move(entry)), type_index(TypeIndex<T_TYPES>(*this->entry.get())) {}
   struct Processor {
     const uint64_t ms;
     State& state;
@@ -203,7 +215,12 @@ struct Entry : Message {
     }
   };
   virtual void Process(State& state) {
-    bricks::metaprogramming::RTTIDynamicCall<T_TYPES>(*entry.get(), Processor(ms, state));
+    static LatencyMetric& entry_latency = Latency("ingestion", "entry");
+    const LatencyScope latency(entry_latency);
+    Processor processor(ms, state);
+    if (!DispatchByTypeIndex<T_TYPES>(type_index, *entry.get(), processor)) {
+      bricks::metaprogramming::RTTIDynamicCall<T_TYPES>(*entry.get(), processor);
+    }
     state.IncrementCounter("entries_total");
   }
 };
@@ -219,16 +236,18 @@ struct ParseErrorLogRecord : Message {
 namespace api {
 
 struct Status : Message {
+  const LatencyScope latency;  // From the request to the response.
   Request r;
   Status() = delete;
-  explicit Status(Request&& r) : r(std::move(r)) {}
+  explicit Status(Request&& r) : latency(Latency("http", FLAGS_route + "/status/")), r(std::move(r)) {}
   virtual void Process(State& state) { r(state); }
 };
 
 struct Chart : Message {
+  const LatencyScope latency;  // From the request to the response.
   Request r;
   Chart() = delete;
-  explicit Chart(Request&& r) : r(std::move(r)) {}
+  explicit Chart(Request&& r) : latency(Latency("http", FLAGS_route + "/mixboard.png")), r(std::move(r)) {}
   virtual void Process(State& state) {
     using namespace bricks::gnuplot;
     if (state.abscissa_min <= state.abscissa_max) {
@@ -321,12 +340,15 @@ int main(int argc, char** argv) {
   const mq::State& immutable_state = consumer.state;
   bricks::mq::MMQ<std::unique_ptr<mq::Message>, mq::Consumer> mmq(consumer);
 
+  METRICS_HTTP_ROUTE(FLAGS_port, FLAGS_metrics_route);
+
   // HTTP(FLAGS_port).Register(FLAGS_route + "/", [](Request r) { r("OK"); });
+  // Timed by the messages themselves, till they are processed, not till they are queued.
   HTTP(FLAGS_port).Register(FLAGS_route + "/status/",
                             [&mmq](Request r) { mmq.EmplaceMessage(new mq::api::Status(std::move(r))); });
   HTTP(FLAGS_port).Register(FLAGS_route + "/mixboard.png",
                             [&mmq](Request r) { mmq.EmplaceMessage(new mq::api::Chart(std::move(r))); });
-  HTTP(FLAGS_port).Register(FLAGS_route + "/", [&immutable_state](Request r) {
+  RegisterTimed(HTTP(FLAGS_port), FLAGS_route + "/", [&immutable_state](Request r) {
     using namespace html;
     HTML html_scope;
     {
@@ -342,26 +364,39 @@ int main(int argc, char** argv) {
 
       std::set<std::string> search_results;
 
-      if (!query.empty()) {
-        const auto& rix = immutable_state.reverse_index;
-        const auto cit = rix.find(query[0]);
-        if (cit != rix.end()) {
-          std::set<std::string>(cit->second.begin(), cit->second.end()).swap(search_results);
-        }
-        for (size_t i = 1u; i < query.size(); ++i) {
-          const auto cit = rix.find(query[0]);
+      // A term ending with `*` matches all the terms starting with it, which are adjacent in the sorted index.
+      const auto& rix = immutable_state.reverse_index;
+      const auto matches = [&rix](const std::string& term) {
+        std::set<std::string> result;
+        if (!term.empty() && term.back() == '*') {
+          const std::string prefix = term.substr(0, term.length() - 1);
+          for (auto cit = rix.lower_bound(prefix);
+               cit != rix.end() && cit->first.compare(0, prefix.length(), prefix) == 0;
+               ++cit) {
+            result.insert(cit->second.begin(), cit->second.end());
+          }
+        } else {
+          const auto cit = rix.find(term);
           if (cit != rix.end()) {
-            std::set<std::string> new_search_results;
-            for (const auto r : search_results) {
-              if (cit->second.count(r)) {
-                new_search_results.insert(r);
-              }
-            }
-            new_search_results.swap(search_results);
-          } else {
-            search_results.clear();
+            result.insert(cit->second.begin(), cit->second.end());
           }
         }
+        return result;
+      };
+
+      for (size_t i = 0u; i < query.size(); ++i) {
+        std::set<std::string> term_results = matches(query[i]);
+        if (i) {
+          std::set<std::string> new_search_results;
+          std::set_intersection(search_results.begin(),
+                                search_results.end(),
+                                term_results.begin(),
+                                term_results.end(),
+                                std::inserter(new_search_results, new_search_results.end()));
+          new_search_results.swap(search_results);
+        } else {
+          term_results.swap(search_results);
+        }
       }
 
       for (const auto r : search_results) {
@@ -426,7 +461,7 @@ int main(int argc, char** argv) {
     r(html_scope.AsString(), HTTPResponseCode.OK, "text/html");
   });
 
-  HTTP(FLAGS_port).Register(FLAGS_route + "/browse", [&immutable_state](Request r) {
+  RegisterTimed(HTTP(FLAGS_port), FLAGS_route + "/browse", [&immutable_state](Request r) {
     const std::string user_query = bricks::strings::ToLower(r.url.query["q"]);
     if (!user_query.empty()) {
       r("",
@@ -512,20 +547,42 @@ int main(int argc, char** argv) {
     }
   });
 
-  std::string log_entry_as_string;
-  LogEntry log_entry;
+  // Standard input or the file, gzipped or not, is decompressed on a dedicated thread.
+  std::unique_ptr<GzipLineSource> source;
+  try {
+    source.reset(FLAGS_input.empty() ? new GzipLineSource()
+                                     : new GzipLineSource(GzipLineSource::OpenFile(FLAGS_input), true));
+  } catch (const std::runtime_error& e) {
+    std::cerr << e.what() << std::endl;
+    return -1;
+  }
+
+  LogLinesBatch batch;
+  LogEntryScanner scanner;
   std::unique_ptr<MidichloriansEvent> log_event;
-  while (std::getline(std::cin, log_entry_as_string)) {
-    try {
-      ParseJSON(log_entry_as_string, log_entry);
+  LatencyMetric& parse_latency = Latency("ingestion", "parse");
+  while (source->ReadBatch(batch, 1000)) {
+    for (const auto& line : batch.lines) {
+      const LatencyScope latency(parse_latency);
+      const char* const begin = batch.Base() + line.first;
+      const char* const end = batch.Base() + line.second;
       try {
-        ParseJSON(log_entry.b, log_event);
-        mmq.EmplaceMessage(new mq::Entry(log_entry.t, std::move(log_event)));
+        // Unescape the body straight from the input line, and only fall back to the full parse if needed.
+        if (!scanner.Scan(begin, end)) {
+          LogEntry log_entry;
+          ParseJSON(std::string(begin, end), log_entry);
+          scanner.t = log_entry.t;
+          scanner.b = std::move(log_entry.b);
+        }
+        try {
+          ParseJSON(scanner.b, log_event);
+          mmq.EmplaceMessage(new mq::Entry(scanner.t, std::move(log_event)));
+        } catch (const bricks::ParseJSONException&) {
+          mmq.EmplaceMessage(new mq::ParseErrorLogMessage());
+        }
       } catch (const bricks::ParseJSONException&) {
-        mmq.EmplaceMessage(new mq::ParseErrorLogMessage());
+        mmq.EmplaceMessage(new mq::ParseErrorLogRecord());
       }
-    } catch (const bricks::ParseJSONException&) {
-      mmq.EmplaceMessage(new mq::ParseErrorLogRecord());
     }
   }
 
@@ -0,0 +1,243 @@
+/*******************************************************************************
+The MIT License (MIT)
+
+Copyright (c) 2015 Dmitry "Dima" Korolev <dmitry.korolev@gmail.com>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*******************************************************************************/
+
+// A compact binary cereal archive: varint-encoded integers, no field names, and interned strings.
+//
+// The archive writes to / reads from an `std::string` buffer, and is meant to be created per record.
+// Strings are interned via the `CompactStringTable` passed in, which outlives the archives, so that
+// a long stream of records with repeating device IDs, event names and so on only spells each string once.
+// The writer and the reader must see the records in the same order for their string tables to agree.
+
+#ifndef COMPACT_ARCHIVE_H
+#define COMPACT_ARCHIVE_H
+
+#include <cstring>
+#include <string>
+#include <type_traits>
+#include <unordered_map>
+#include <vector>
+
+#include "../Current/Bricks/cerealize/cerealize.h"
+
+struct CompactArchiveException : std::exception {
+  const char* what() const noexcept override { return "Malformed compact binary data."; }
+};
+
+inline void AppendVarInt(uint64_t value, std::string& output) {
+  while (value >= 0x80) {
+    output += static_cast<char>((value & 0x7f) | 0x80);
+    value >>= 7;
+  }
+  output += static_cast<char>(value);
+}
+
+inline uint64_t ReadVarInt(const char*& p, const char* end) {
+  uint64_t value = 0;
+  for (int shift = 0; shift < 64; shift += 7) {
+    if (p == end) {
+      throw CompactArchiveException();
+    }
+    const uint8_t byte = static_cast<uint8_t>(*p++);
+    value |= static_cast<uint64_t>(byte & 0x7f) << shift;
+    if (!(byte & 0x80)) {
+      return value;
+    }
+  }
+  throw CompactArchiveException();
+}
+
+inline uint64_t ZigZagEncode(int64_t value) {
+  return (static_cast<uint64_t>(value) << 1) ^ static_cast<uint64_t>(value >> 63);
+}
+
+inline int64_t ZigZagDecode(uint64_t value) {
+  return static_cast<int64_t>(value >> 1) ^ -static_cast<int64_t>(value & 1);
+}
+
+// Strings are encoded as a varint: `0`, followed by the length and the bytes, for a string seen for the first
+// time, or the 1-based index of a previously seen one. Only short strings are interned, and only up to a limit,
+// so that the table does not grow without bound on unique payloads.
+struct CompactStringTable {
+  enum { kMaxInternedStringLength = 128, kMaxInternedStrings = 1 << 20 };
+  std::unordered_map<std::string, uint64_t> index;  // For writing.
+  std::vector<std::string> strings;                 // For reading.
+
+  static bool ShouldIntern(size_t length) { return length <= kMaxInternedStringLength; }
+  bool HasRoom() const { return index.size() + strings.size() < kMaxInternedStrings; }
+};
+
+namespace cereal {
+
+class CompactBinaryOutputArchive : public OutputArchive<CompactBinaryOutputArchive, AllowEmptyClassElision> {
+ public:
+  CompactBinaryOutputArchive(std::string& output, CompactStringTable& strings)
+      : OutputArchive<CompactBinaryOutputArchive, AllowEmptyClassElision>(this),
+        output_(output),
+        strings_(strings) {}
+
+  template <typename T>
+  typename std::enable_if<std::is_integral<T>::value && std::is_unsigned<T>::value>::type SaveArithmetic(
+      T t) {
+    AppendVarInt(static_cast<uint64_t>(t), output_);
+  }
+  template <typename T>
+  typename std::enable_if<std::is_integral<T>::value && std::is_signed<T>::value>::type SaveArithmetic(T t) {
+    AppendVarInt(ZigZagEncode(static_cast<int64_t>(t)), output_);
+  }
+  template <typename T>
+  typename std::enable_if<std::is_floating_point<T>::value>::type SaveArithmetic(T t) {
+    output_.append(reinterpret_cast<const char*>(&t), sizeof(T));
+  }
+
+  void SaveString(const std::string& s) {
+    if (CompactStringTable::ShouldIntern(s.length())) {
+      const auto cit = strings_.index.find(s);
+      if (cit != strings_.index.end()) {
+        AppendVarInt(cit->second, output_);
+        return;
+      }
+      if (strings_.HasRoom()) {
+        strings_.index.emplace(s, strings_.index.size() + 1);
+      }
+    }
+    AppendVarInt(0, output_);
+    AppendVarInt(s.length(), output_);
+    output_.append(s);
+  }
+
+ private:
+  std::string& output_;
+  CompactStringTable& strings_;
+};
+
+class CompactBinaryInputArchive : public InputArchive<CompactBinaryInputArchive, AllowEmptyClassElision> {
+ public:
+  CompactBinaryInputArchive(const char* begin, const char* end, CompactStringTable& strings)
+      : InputArchive<CompactBinaryInputArchive, AllowEmptyClassElision>(this),
+        p_(begin),
+        end_(end),
+        strings_(strings) {}
+
+  template <typename T>
+  typename std::enable_if<std::is_integral<T>::value && std::is_unsigned<T>::value>::type LoadArithmetic(
+      T& t) {
+    t = static_cast<T>(ReadVarInt(p_, end_));
+  }
+  template <typename T>
+  typename std::enable_if<std::is_integral<T>::value && std::is_signed<T>::value>::type LoadArithmetic(T& t) {
+    t = static_cast<T>(ZigZagDecode(ReadVarInt(p_, end_)));
+  }
+  template <typename T>
+  typename std::enable_if<std::is_floating_point<T>::value>::type LoadArithmetic(T& t) {
+    if (static_cast<size_t>(end_ - p_) < sizeof(T)) {
+      throw CompactArchiveException();
+    }
+    std::memcpy(&t, p_, sizeof(T));
+    p_ += sizeof(T);
+  }
+
+  void LoadString(std::string& s) {
+    const uint64_t code = ReadVarInt(p_, end_);
+    if (code) {
+      if (code > strings_.strings.size()) {
+        throw CompactArchiveException();
+      }
+      s = strings_.strings[code - 1];
+    } else {
+      const uint64_t length = ReadVarInt(p_, end_);
+      if (static_cast<uint64_t>(end_ - p_) < length) {
+        throw CompactArchiveException();
+      }
+      s.assign(p_, static_cast<size_t>(length));
+      p_ += length;
+      if (CompactStringTable::ShouldIntern(s.length()) && strings_.HasRoom()) {
+        strings_.strings.push_back(s);
+      }
+    }
+  }
+
+  bool Done() const { return p_ == end_; }
+
+ private:
+  const char* p_;
+  const char* const end_;
+  CompactStringTable& strings_;
+};
+
+template <class T>
+inline typename std::enable_if<std::is_arithmetic<T>::value, void>::type CEREAL_SAVE_FUNCTION_NAME(
+    CompactBinaryOutputArchive& ar, T const& t) {
+  ar.SaveArithmetic(t);
+}
+
+template <class T>
+inline typename std::enable_if<std::is_arithmetic<T>::value, void>::type CEREAL_LOAD_FUNCTION_NAME(
+    CompactBinaryInputArchive& ar, T& t) {
+  ar.LoadArithmetic(t);
+}
+
+inline void CEREAL_SAVE_FUNCTION_NAME(CompactBinaryOutputArchive& ar, std::string const& s) {
+  ar.SaveString(s);
+}
+
+inline void CEREAL_LOAD_FUNCTION_NAME(CompactBinaryInputArchive& ar, std::string& s) { ar.LoadString(s); }
+
+// Field names are not stored.
+template <class Archive, class T>
+inline CEREAL_ARCHIVE_RESTRICT(CompactBinaryInputArchive, CompactBinaryOutputArchive)
+    CEREAL_SERIALIZE_FUNCTION_NAME(Archive& ar, NameValuePair<T>& t) {
+  ar(t.value);
+}
+
+// Container sizes are varints.
+template <class Archive, class T>
+inline CEREAL_ARCHIVE_RESTRICT(CompactBinaryInputArchive, CompactBinaryOutputArchive)
+    CEREAL_SERIALIZE_FUNCTION_NAME(Archive& ar, SizeTag<T>& t) {
+  ar(t.size);
+}
+
+}  // namespace cereal
+
+CEREAL_REGISTER_ARCHIVE(cereal::CompactBinaryOutputArchive)
+CEREAL_REGISTER_ARCHIVE(cereal::CompactBinaryInputArchive)
+CEREAL_SETUP_ARCHIVE_TRAITS(cereal::CompactBinaryInputArchive, cereal::CompactBinaryOutputArchive)
+
+// Serializes `object` into `output`, appending to it.
+template <typename T>
+void SaveCompact(const T& object, std::string& output, CompactStringTable& strings) {
+  cereal::CompactBinaryOutputArchive ar(output, strings);
+  ar(object);
+}
+
+// Deserializes `object` from [begin, end), which should contain exactly one object.
+template <typename T>
+void LoadCompact(T& object, const char* begin, const char* end, CompactStringTable& strings) {
+  cereal::CompactBinaryInputArchive ar(begin, end, strings);
+  ar(object);
+  if (!ar.Done()) {
+    throw CompactArchiveException();
+  }
+}
+
+#endif  // COMPACT_ARCHIVE_H
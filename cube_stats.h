@@ -0,0 +1,238 @@
+/*******************************************************************************
+The MIT License (MIT)
+
+Copyright (c) 2015 Dmitry "Dima" Korolev <dmitry.korolev@gmail.com>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*******************************************************************************/
+
+// The histograms of the feature counts of the finalized sessions, for the cube export, `/c`, maintained as the
+// sessions are finalized, rather than recomputed from all of them on each export.
+//
+// Splitting a feature into bins is the expensive part, so the bins are cached, and only recomputed once the
+// histogram of the feature has changed materially: the number of its sessions has grown by a fraction, or,
+// for the features binned by their distinct values, a new value has appeared. The most recent sessions are
+// also kept, in the order they were finalized in, for `/c?since=<cursor>` to only return the new ones.
+
+#ifndef CUBE_STATS_H
+#define CUBE_STATS_H
+
+#include <algorithm>
+#include <cassert>
+#include <cstdint>
+#include <cstdio>
+#include <deque>
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "cubes.h"
+#include "features.h"
+
+#include "../Current/Bricks/strings/printf.h"
+#include "../Current/Bricks/time/chrono.h"
+
+// The response to `/c?since=<cursor>`.
+struct CubeDelta {
+  std::string cursor;  // To pass as `since` the next time.
+  bool full = false;   // Whether `cube.sessions` are all the sessions, as the `since` cursor was too old.
+  CubeGeneratorInput cube;
+  template <typename A>
+  void serialize(A& ar) {
+    ar(CEREAL_NVP(cursor), CEREAL_NVP(full), CEREAL_NVP(cube));
+  }
+};
+
+class CubeStats {
+ public:
+  // Rebin a feature once the number of its sessions has grown by this many percent since the last time.
+  enum { kRebinGrowthPercent = 10 };
+  // Up to this many distinct values, `Dimension::SmartCreateBins()` makes a bin of each.
+  enum { kMaxDistinctValuesBinnedExactly = 8 };
+
+  explicit CubeStats(size_t max_recent_sessions)
+      : epoch_(static_cast<uint64_t>(bricks::time::Now())), max_recent_sessions_(max_recent_sessions) {}
+
+  static CubeGeneratorInput::Session ExportSession(const std::string& sid,
+                                                   size_t number_of_seconds,
+                                                   const FeatureCounters& counters) {
+    CubeGeneratorInput::Session session;
+    session.id = sid;
+    // Dedicated handling for the "number of seconds" dimension.
+    session.feature_count[TIME_DIMENSION_NAME] = number_of_seconds;
+    // Generic handling for all tracked dimensions.
+    counters.ForEachByName([&session](const std::string& feature, size_t count) {
+      session.feature_count[feature] = count;
+    });
+    return session;
+  }
+
+  void AddSession(const std::string& sid, size_t number_of_seconds, const FeatureCounters& counters) {
+    Add(TIME_DIMENSION_NAME, number_of_seconds);
+    counters.ForEachByName([this](const std::string& feature, size_t count) { Add(feature, count); });
+    if (max_recent_sessions_) {
+      recent_sessions_.push_back(RecentSession{sid, number_of_seconds, counters});
+      if (recent_sessions_.size() > max_recent_sessions_) {
+        recent_sessions_.pop_front();
+      }
+    }
+    ++number_of_sessions_;
+  }
+
+  // The position past the sessions added so far.
+  std::string Cursor() const {
+    return bricks::strings::Printf("%llu-%llu",
+                                   static_cast<unsigned long long>(epoch_),
+                                   static_cast<unsigned long long>(number_of_sessions_));
+  }
+
+  // Whether the sessions added past the `cursor` can be listed: false if the cursor is malformed, is from
+  // before a restart, or is older than the recent sessions kept. Once false for a cursor, it stays false.
+  bool IsRecentCursor(const std::string& cursor) const {
+    size_t new_sessions;
+    return NewSessionsSince(cursor, new_sessions);
+  }
+
+  // Calls `f(session)` for each session added past the `cursor`. Returns false, and calls nothing, unless
+  // `IsRecentCursor(cursor)`.
+  template <typename F>
+  bool ForEachSessionSince(const std::string& cursor, F&& f) const {
+    size_t new_sessions;
+    if (!NewSessionsSince(cursor, new_sessions)) {
+      return false;
+    }
+    for (size_t i = recent_sessions_.size() - new_sessions; i < recent_sessions_.size(); ++i) {
+      const RecentSession& session = recent_sessions_[i];
+      f(ExportSession(session.sid, session.number_of_seconds, session.counters));
+    }
+    return true;
+  }
+
+  // Fills in the dimensions of the cube, rebinning the features whose histograms have changed materially.
+  void PopulateSpace(Space& space) {
+    auto& dimensions = space.dimensions;
+
+    // Put `Session Length` and `Device` dimensions first.
+    const std::vector<size_t> second_marks({5, 10, 15, 30, 60, 120, 300});
+    dimensions.emplace_back(TIME_DIMENSION_NAME);
+    Dimension& time_dimension = dimensions.back();
+    assert(second_marks.size() > 1u);
+    for (size_t i = 0; i < second_marks.size() - 1u; ++i) {
+      const size_t a = second_marks[i];
+      const size_t b = (i != second_marks.size() - 2u) ? second_marks[i + 1] - 1u : second_marks[i + 1];
+      if (i == 0) {
+        Bin first_bin("< " + std::to_string(a), a, Bin::RangeType::LESS);
+        time_dimension.bins.push_back(first_bin);
+      }
+      Bin bin_range(std::to_string(a) + " - " + std::to_string(b), a, b, Bin::RangeType::INTERVAL);
+      time_dimension.bins.push_back(bin_range);
+      if (i == second_marks.size() - 2u) {
+        Bin last_bin("> " + std::to_string(b), b, Bin::RangeType::GREATER);
+        time_dimension.bins.push_back(last_bin);
+      }
+    }
+    dimensions.emplace_back(DEVICE_DIMENSION_NAME);
+    dimensions.back().bins.emplace_back(DEVICE_UNSPECIFIED_BIN_NAME);
+
+    // Fill dimensions info in the response.
+    for (auto& cit : histograms_) {
+      const std::string& feature = cit.first;
+
+      const auto dim_bin = space.SplitFeatureIntoDimensionAndBinNames(feature);
+      if (dim_bin.first.empty()) {
+        // Skip filtered out features.
+        continue;
+      }
+
+      Dimension* dim_in_space = space.DimensionByName(dim_bin.first);
+      if (dim_bin.second.empty()) {
+        assert(!dim_in_space);
+        dimensions.push_back(Binned(dim_bin.first, cit.second));
+      } else {
+        if (!dim_in_space) {
+          Dimension dim(dim_bin.first);
+          dimensions.push_back(dim);
+          dim_in_space = &dimensions.back();
+        }
+        Bin bin(dim_bin.second, feature);
+        dim_in_space->AddBinIfNotExists(bin);
+      }
+    }
+  }
+
+ private:
+  struct Histogram {
+    std::map<size_t, size_t> counts;  // Feature count in session -> number of sessions with this count.
+    size_t sessions = 0;
+    // The bins as of the last time they were computed.
+    Dimension dimension;
+    size_t binned_sessions = 0;
+    size_t binned_distinct_values = 0;
+  };
+
+  struct RecentSession {
+    std::string sid;
+    size_t number_of_seconds;
+    FeatureCounters counters;
+  };
+
+  bool NewSessionsSince(const std::string& cursor, size_t& new_sessions) const {
+    unsigned long long epoch;
+    unsigned long long position;
+    char extra;
+    if (std::sscanf(cursor.c_str(), "%llu-%llu%c", &epoch, &position, &extra) != 2 || epoch != epoch_ ||
+        position > number_of_sessions_ || number_of_sessions_ - position > recent_sessions_.size()) {
+      return false;
+    }
+    new_sessions = static_cast<size_t>(number_of_sessions_ - position);
+    return true;
+  }
+
+  void Add(const std::string& feature, size_t count) {
+    Histogram& histogram = histograms_[feature];
+    ++histogram.counts[count];
+    ++histogram.sessions;
+  }
+
+  static const Dimension& Binned(const std::string& name, Histogram& histogram) {
+    const size_t distinct_values = histogram.counts.size();
+    const bool grown = histogram.sessions * 100 >= histogram.binned_sessions * (100 + kRebinGrowthPercent);
+    const bool new_exact_bins = distinct_values != histogram.binned_distinct_values &&
+                                std::min(distinct_values, histogram.binned_distinct_values) <=
+                                    static_cast<size_t>(kMaxDistinctValuesBinnedExactly);
+    if (!histogram.binned_sessions || grown || new_exact_bins) {
+      Dimension dim(name);
+      dim.bins.emplace_back(NONE_BIN_NAME);
+      dim.SmartCreateBins(histogram.counts);
+      histogram.dimension = std::move(dim);
+      histogram.binned_sessions = histogram.sessions;
+      histogram.binned_distinct_values = distinct_values;
+    }
+    return histogram.dimension;
+  }
+
+  const uint64_t epoch_;  // Tells the cursors from before a restart apart.
+  const size_t max_recent_sessions_;
+  std::map<std::string, Histogram> histograms_;
+  std::deque<RecentSession> recent_sessions_;
+  uint64_t number_of_sessions_ = 0;
+};
+
+#endif  // CUBE_STATS_H
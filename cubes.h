@@ -23,10 +23,17 @@ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
 SOFTWARE.
 *******************************************************************************/
 
+#ifndef CUBES_H
+#define CUBES_H
+
+#include <cassert>
+#include <functional>
 #include <string>
 #include <vector>
 #include <map>
 
+#include "../Current/Bricks/cerealize/cerealize.h"
+
 const std::string TIME_DIMENSION_NAME = "Session length, seconds";
 const std::string DEVICE_DIMENSION_NAME = "Device";
 const std::string DEVICE_UNSPECIFIED_BIN_NAME = "Unspecified";
@@ -285,3 +292,5 @@ struct CubeGeneratorInput {
     ar(CEREAL_NVP(space), CEREAL_NVP(sessions));
   }
 };
+
+#endif  // CUBES_H
@@ -0,0 +1,111 @@
+/*******************************************************************************
+The MIT License (MIT)
+
+Copyright (c) 2015 Dmitry "Dima" Korolev <dmitry.korolev@gmail.com>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*******************************************************************************/
+
+// Dispatching polymorphic objects to visitors by the index of their exact type in a type list.
+//
+// `RTTIDynamicCall<TYPES>` resolves the type of the object on every call. Here the index of the type is
+// resolved once, and can be kept next to the object, after which each call is a single indirect call through
+// a table of functions built per visitor type. Only depends on the standard library, so that both `v2.cc` and
+// `code.cc` can use it.
+
+#ifndef DISPATCH_H
+#define DISPATCH_H
+
+#include <cstddef>
+#include <tuple>
+#include <type_traits>
+#include <typeindex>
+#include <typeinfo>
+#include <unordered_map>
+#include <utility>
+
+const size_t kUnknownTypeIndex = static_cast<size_t>(-1);
+
+template <typename TYPES, size_t I = 0, size_t N = std::tuple_size<TYPES>::value>
+struct TypeIndexMapFiller {
+  static void Fill(std::unordered_map<std::type_index, size_t>& map) {
+    map.emplace(std::type_index(typeid(typename std::tuple_element<I, TYPES>::type)), I);
+    TypeIndexMapFiller<TYPES, I + 1, N>::Fill(map);
+  }
+};
+
+template <typename TYPES, size_t N>
+struct TypeIndexMapFiller<TYPES, N, N> {
+  static void Fill(std::unordered_map<std::type_index, size_t>&) {}
+};
+
+// The index of the exact type of `object` in `TYPES`, or `kUnknownTypeIndex`.
+template <typename TYPES, typename BASE>
+size_t TypeIndex(const BASE& object) {
+  static const std::unordered_map<std::type_index, size_t> map = []() {
+    std::unordered_map<std::type_index, size_t> map;
+    TypeIndexMapFiller<TYPES>::Fill(map);
+    return map;
+  }();
+  const auto cit = map.find(std::type_index(typeid(object)));
+  return cit != map.end() ? cit->second : kUnknownTypeIndex;
+}
+
+template <typename TYPES, typename BASE, typename F>
+struct TypeIndexJumpTable {
+  typedef void (*Handler)(BASE&, F&);
+  enum { N = std::tuple_size<TYPES>::value };
+  Handler handlers[N];
+
+  template <size_t I>
+  static void Handle(BASE& object, F& f) {
+    typedef typename std::tuple_element<I, TYPES>::type T;
+    f(static_cast<typename std::conditional<std::is_const<BASE>::value, const T&, T&>::type>(object));
+  }
+
+  template <size_t I, size_t END>
+  struct Filler {
+    static void Fill(Handler* handlers) {
+      handlers[I] = &Handle<I>;
+      Filler<I + 1, END>::Fill(handlers);
+    }
+  };
+  template <size_t END>
+  struct Filler<END, END> {
+    static void Fill(Handler*) {}
+  };
+
+  TypeIndexJumpTable() { Filler<0, N>::Fill(handlers); }
+};
+
+// Calls `f` with `object` cast to the type at `index` in `TYPES`, which should be the exact type of `object`.
+// Returns false, without calling `f`, if `index` is `kUnknownTypeIndex`.
+template <typename TYPES, typename BASE, typename F>
+bool DispatchByTypeIndex(size_t index, BASE& object, F&& f) {
+  typedef TypeIndexJumpTable<TYPES, BASE, typename std::remove_reference<F>::type> T_JUMP_TABLE;
+  static const T_JUMP_TABLE table;
+  if (index < T_JUMP_TABLE::N) {
+    table.handlers[index](object, f);
+    return true;
+  } else {
+    return false;
+  }
+}
+
+#endif  // DISPATCH_H
@@ -0,0 +1,126 @@
+/*******************************************************************************
+The MIT License (MIT)
+
+Copyright (c) 2015 Dmitry "Dima" Korolev <dmitry.korolev@gmail.com>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*******************************************************************************/
+
+// A compact list of event IDs: zigzag varint deltas, one to three bytes per event for the EID-s of a session,
+// which are increasing microsecond timestamps, instead of eight.
+//
+// Appending and forward iteration only. Serialized as the plain list of EID-s, so that the exported data
+// does not change.
+
+#ifndef EVENT_LIST_H
+#define EVENT_LIST_H
+
+#include <cstdint>
+#include <iterator>
+#include <string>
+#include <vector>
+
+#include "compact_archive.h"
+
+#include "../Current/Bricks/cerealize/cerealize.h"
+
+class CompactEventList {
+ public:
+  class const_iterator : public std::iterator<std::forward_iterator_tag, uint64_t> {
+   public:
+    const_iterator(const char* p, const char* end) : p_(p), end_(end) { Decode(); }
+    uint64_t operator*() const { return value_; }
+    const_iterator& operator++() {
+      Decode();
+      return *this;
+    }
+    bool operator==(const const_iterator& rhs) const { return current_ == rhs.current_; }
+    bool operator!=(const const_iterator& rhs) const { return current_ != rhs.current_; }
+
+   private:
+    void Decode() {
+      current_ = p_;
+      if (p_ != end_) {
+        value_ += static_cast<uint64_t>(ZigZagDecode(ReadVarInt(p_, end_)));
+      }
+    }
+
+    const char* p_;
+    const char* end_;
+    const char* current_;  // The beginning of the encoded `value_`, or `end_`.
+    uint64_t value_ = 0;
+  };
+
+  void push_back(uint64_t eid) {
+    AppendVarInt(ZigZagEncode(static_cast<int64_t>(eid - last_)), data_);
+    last_ = eid;
+    ++size_;
+  }
+
+  size_t size() const { return size_; }
+  bool empty() const { return !size_; }
+
+  const_iterator begin() const { return const_iterator(data_.data(), data_.data() + data_.length()); }
+  const_iterator end() const {
+    return const_iterator(data_.data() + data_.length(), data_.data() + data_.length());
+  }
+
+  std::vector<uint64_t> AsVector() const { return std::vector<uint64_t>(begin(), end()); }
+
+  void Assign(const std::vector<uint64_t>& eids) {
+    clear();
+    for (const uint64_t eid : eids) {
+      push_back(eid);
+    }
+  }
+
+  void clear() {
+    data_.clear();
+    last_ = 0;
+    size_ = 0;
+  }
+
+  void shrink_to_fit() { data_.shrink_to_fit(); }
+
+  // Bytes allocated for the encoded EID-s.
+  size_t MemoryUsage() const { return data_.capacity(); }
+
+ private:
+  std::string data_;
+  uint64_t last_ = 0;
+  size_t size_ = 0;
+};
+
+namespace cereal {
+
+template <class Archive>
+void CEREAL_SAVE_FUNCTION_NAME(Archive& ar, const CompactEventList& events) {
+  CEREAL_SAVE_FUNCTION_NAME(ar, events.AsVector());
+}
+
+template <class Archive>
+void CEREAL_LOAD_FUNCTION_NAME(Archive& ar, CompactEventList& events) {
+  std::vector<uint64_t> eids;
+  CEREAL_LOAD_FUNCTION_NAME(ar, eids);
+  events.Assign(eids);
+}
+
+}  // namespace cereal
+
+#endif  // EVENT_LIST_H
@@ -0,0 +1,126 @@
+/*******************************************************************************
+The MIT License (MIT)
+
+Copyright (c) 2015 Dmitry "Dima" Korolev <dmitry.korolev@gmail.com>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*******************************************************************************/
+
+// Replays Midichlorians JSON log lines, groups the events into sessions the way `v2` does, and reports how much
+// memory the event ID-s of the finalized sessions take, as `std::vector<uint64_t>` and as `CompactEventList`.
+
+#include <map>
+
+#include "stdin_parse.h"
+#include "event_list.h"
+
+#include "../Current/Bricks/dflags/dflags.h"
+
+DEFINE_string(input, "", "The file with JSON log lines, plain or gzipped, to replay. Stdin if not set.");
+DEFINE_int32(parse_threads, 4, "The number of threads to parse input log entries on.");
+DEFINE_uint64(session_timeout_ms, 10 * 60 * 1000, "End the session of a group after this long w/o events.");
+
+typedef EventWithTimestamp<MidichloriansEvent> MidichloriansEventWithTimestamp;
+
+struct Session {
+  uint64_t ms_last = 0;
+  std::vector<uint64_t> vector_events;
+  CompactEventList compact_events;
+};
+
+struct Totals {
+  size_t sessions = 0;
+  size_t events = 0;
+  size_t vector_bytes = 0;
+  size_t compact_bytes = 0;
+
+  void Finalize(Session& session) {
+    // Both as held by a finalized session: the vector as is, the compact list shrunk to fit.
+    session.compact_events.shrink_to_fit();
+    ++sessions;
+    events += session.vector_events.size();
+    vector_bytes += session.vector_events.capacity() * sizeof(uint64_t);
+    compact_bytes += session.compact_events.MemoryUsage();
+  }
+};
+
+int main(int argc, char** argv) {
+  ParseDFlags(&argc, &argv);
+
+  std::unique_ptr<LogLineSource> source;
+  try {
+    if (FLAGS_input.empty()) {
+      source.reset(new GzipLineSource());
+    } else if (IsGzipFileName(FLAGS_input)) {
+      source.reset(new GzipLineSource(GzipLineSource::OpenFile(FLAGS_input), true));
+    } else {
+      source.reset(new MemoryMappedLineSource(FLAGS_input));
+    }
+  } catch (const std::runtime_error& e) {
+    std::cerr << e.what() << std::endl;
+    return -1;
+  }
+
+  bricks::WaitableAtomic<State> state;
+  IngestionStats stats;
+  LogParsingPipeline<MidichloriansEvent, MidichloriansEventWithTimestamp> pipeline(
+      std::move(source), state, stats, static_cast<size_t>(std::max(FLAGS_parse_threads, 1)));
+
+  Totals totals;
+  std::map<std::string, Session> open;
+  uint64_t last_key = 0;
+  LogParsingPipeline<MidichloriansEvent, MidichloriansEventWithTimestamp>::ENTRIES entries;
+  while (pipeline.NextBatch(entries)) {
+    for (const auto& entry : entries) {
+      last_key = NextEntryKey(last_key, entry->ms, !entry->e);
+      if (!entry->e || entry->e->device_id.empty()) {
+        continue;
+      }
+      const std::string gid = "CID:" + entry->e->device_id;
+      const auto it = open.find(gid);
+      if (it != open.end() && entry->ms - it->second.ms_last > FLAGS_session_timeout_ms) {
+        totals.Finalize(it->second);
+        open.erase(it);
+      }
+      Session& session = open[gid];
+      session.ms_last = entry->ms;
+      session.vector_events.push_back(last_key);
+      session.compact_events.push_back(last_key);
+    }
+  }
+  for (auto& cit : open) {
+    totals.Finalize(cit.second);
+  }
+
+  if (!totals.events) {
+    std::cerr << "No events to report on." << std::endl;
+    return -1;
+  }
+  fprintf(stderr,
+          "%lu events in %lu sessions.\n"
+          "std::vector<uint64_t>: %lu bytes, %.2f per event.\n"
+          "CompactEventList:      %lu bytes, %.2f per event, %.1f%% of the above.\n",
+          totals.events,
+          totals.sessions,
+          totals.vector_bytes,
+          1.0 * totals.vector_bytes / totals.events,
+          totals.compact_bytes,
+          1.0 * totals.compact_bytes / totals.events,
+          100.0 * totals.compact_bytes / totals.vector_bytes);
+}
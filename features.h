@@ -0,0 +1,206 @@
+/*******************************************************************************
+The MIT License (MIT)
+
+Copyright (c) 2015 Dmitry "Dima" Korolev <dmitry.korolev@gmail.com>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*******************************************************************************/
+
+// Features: canonical event descriptions, interned into dense IDs.
+//
+// Sessions count features by ID, in small sorted vectors, and the names are only looked up on export.
+// The ID of the feature of an event is cached per event type, keyed by the fields the description is built
+// from, so that repeated events do not build the description string at all.
+
+#ifndef FEATURES_H
+#define FEATURES_H
+
+#include <algorithm>
+#include <cstdint>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "types.h"
+
+#include "../Current/Bricks/cerealize/cerealize.h"
+#include "../Current/Bricks/util/singleton.h"
+
+const uint32_t kNoFeature = static_cast<uint32_t>(-1);
+
+class FeatureDictionary {
+ public:
+  uint32_t ID(const std::string& name) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return Intern(name);
+  }
+
+  // The reference stays valid, as names are never removed.
+  const std::string& Name(uint32_t id) const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return names_[id];
+  }
+
+  // The ID of `event.CanonicalDescription()`, or `kNoFeature` if it is empty.
+  template <typename E>
+  uint32_t FeatureID(const EventWithTimestamp<E>& event) {
+    if (!event.e) {
+      return kNoFeature;
+    }
+    std::lock_guard<std::mutex> lock(mutex_);
+    CachedFeatureID<E> cached(*this, event);
+    event.DispatchEvent(cached);
+    return cached.id;
+  }
+
+ private:
+  enum : uint32_t { kNotCached = static_cast<uint32_t>(-2) };
+
+  uint32_t Intern(const std::string& name) {
+    const auto cit = ids_.find(name);
+    if (cit != ids_.end()) {
+      return cit->second;
+    }
+    const uint32_t id = static_cast<uint32_t>(names_.size());
+    names_.push_back(name);
+    ids_.emplace(name, id);
+    return id;
+  }
+
+  // Should agree with `EventWithTimestamp::CanonicalDescription()`, which is called on cache misses.
+  template <typename E>
+  struct CachedFeatureID {
+    FeatureDictionary& self;
+    const EventWithTimestamp<E>& event;
+    uint32_t id = kNoFeature;
+    CachedFeatureID(FeatureDictionary& self, const EventWithTimestamp<E>& event) : self(self), event(event) {}
+    void operator()(const iOSIdentifyEvent&) {}
+    void operator()(const iOSDeviceInfo& e) {
+      const auto cit = e.info.find("deviceModel");
+      if (cit != e.info.end()) {
+        id = Lookup(self.device_model_[cit->second]);
+      } else {
+        id = Lookup(self.device_model_unknown_);
+      }
+    }
+    void operator()(const iOSAppLaunchEvent&) { id = Lookup(self.app_launch_); }
+    void operator()(const iOSFirstLaunchEvent&) {}
+    void operator()(const iOSFocusEvent&) {}
+    void operator()(const iOSGenericEvent& e) { id = Lookup(self.generic_[e.event][e.source]); }
+    void operator()(const iOSBaseEvent& e) { id = Lookup(self.base_description_[e.description]); }
+    uint32_t Lookup(uint32_t& cached) {
+      if (cached == kNotCached) {
+        const std::string description = event.CanonicalDescription();
+        cached = description.empty() ? kNoFeature : self.Intern(description);
+      }
+      return cached;
+    }
+  };
+
+  struct CachedID {
+    uint32_t id = kNotCached;
+    operator uint32_t&() { return id; }
+  };
+
+  mutable std::mutex mutex_;
+  std::unordered_map<std::string, uint32_t> ids_;
+  std::deque<std::string> names_;
+
+  // Per event type caches.
+  std::unordered_map<std::string, CachedID> device_model_;
+  CachedID device_model_unknown_;
+  CachedID app_launch_;
+  std::unordered_map<std::string, std::unordered_map<std::string, CachedID>> generic_;  // [event][source].
+  std::unordered_map<std::string, CachedID> base_description_;
+};
+
+// Per-session feature counters: { feature ID, count } pairs, sorted by ID.
+// Serialized as the map from feature names to counts, so that the exported data does not change.
+struct FeatureCounters {
+  std::vector<std::pair<uint32_t, uint32_t>> counters;
+
+  void Increment(uint32_t id) {
+    const auto it = std::lower_bound(
+        counters.begin(), counters.end(), id, [](const std::pair<uint32_t, uint32_t>& lhs, uint32_t rhs) {
+          return lhs.first < rhs;
+        });
+    if (it != counters.end() && it->first == id) {
+      ++it->second;
+    } else {
+      counters.emplace(it, id, 1u);
+    }
+  }
+
+  bool empty() const { return counters.empty(); }
+
+  // Calls `f(name, count)` in the order of feature names.
+  template <typename F>
+  void ForEachByName(F&& f) const {
+    const FeatureDictionary& dictionary = bricks::Singleton<FeatureDictionary>();
+    std::vector<std::pair<const std::string*, size_t>> named;
+    named.reserve(counters.size());
+    for (const auto& counter : counters) {
+      named.emplace_back(&dictionary.Name(counter.first), counter.second);
+    }
+    std::sort(named.begin(), named.end(), [](const std::pair<const std::string*, size_t>& lhs,
+                                             const std::pair<const std::string*, size_t>& rhs) {
+      return *lhs.first < *rhs.first;
+    });
+    for (const auto& counter : named) {
+      f(*counter.first, counter.second);
+    }
+  }
+
+  std::map<std::string, size_t> AsMap() const {
+    std::map<std::string, size_t> result;
+    ForEachByName([&result](const std::string& name, size_t count) { result.emplace(name, count); });
+    return result;
+  }
+
+  void Assign(const std::map<std::string, size_t>& map) {
+    FeatureDictionary& dictionary = bricks::Singleton<FeatureDictionary>();
+    counters.clear();
+    for (const auto& counter : map) {
+      counters.emplace_back(dictionary.ID(counter.first), static_cast<uint32_t>(counter.second));
+    }
+    std::sort(counters.begin(), counters.end());
+  }
+};
+
+namespace cereal {
+
+template <class Archive>
+void CEREAL_SAVE_FUNCTION_NAME(Archive& ar, const FeatureCounters& counters) {
+  CEREAL_SAVE_FUNCTION_NAME(ar, counters.AsMap());
+}
+
+template <class Archive>
+void CEREAL_LOAD_FUNCTION_NAME(Archive& ar, FeatureCounters& counters) {
+  std::map<std::string, size_t> map;
+  CEREAL_LOAD_FUNCTION_NAME(ar, map);
+  counters.Assign(map);
+}
+
+}  // namespace cereal
+
+#endif  // FEATURES_H
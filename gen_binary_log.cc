@@ -0,0 +1,92 @@
+/*******************************************************************************
+The MIT License (MIT)
+
+Copyright (c) 2015 Dmitry "Dima" Korolev <dmitry.korolev@gmail.com>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*******************************************************************************/
+
+// Converts Midichlorians JSON log lines into the binary event log, to be replayed via `v2 --binary_input`.
+
+#include <fstream>
+
+#include "stdin_parse.h"
+#include "binary_log.h"
+
+#include "../Current/Bricks/dflags/dflags.h"
+
+DEFINE_string(input, "", "The file with JSON log lines, plain or gzipped, to convert. Stdin if not set.");
+DEFINE_string(output, "data/events.bin", "The file to write the binary event log into.");
+DEFINE_int32(parse_threads, 4, "The number of threads to parse input log entries on.");
+
+typedef EventWithTimestamp<MidichloriansEvent> MidichloriansEventWithTimestamp;
+
+int main(int argc, char** argv) {
+  ParseDFlags(&argc, &argv);
+
+  std::unique_ptr<LogLineSource> source;
+  try {
+    if (FLAGS_input.empty()) {
+      source.reset(new GzipLineSource());
+    } else if (IsGzipFileName(FLAGS_input)) {
+      source.reset(new GzipLineSource(GzipLineSource::OpenFile(FLAGS_input), true));
+    } else {
+      source.reset(new MemoryMappedLineSource(FLAGS_input));
+    }
+  } catch (const std::runtime_error& e) {
+    std::cerr << e.what() << std::endl;
+    return -1;
+  }
+
+  std::ofstream fo(FLAGS_output, std::ios::binary);
+  if (!fo) {
+    std::cerr << "Can not open `" << FLAGS_output << "` for writing." << std::endl;
+    return -1;
+  }
+
+  bricks::WaitableAtomic<State> state;
+  IngestionStats stats;
+  LogParsingPipeline<MidichloriansEvent, MidichloriansEventWithTimestamp> pipeline(
+      std::move(source), state, stats, static_cast<size_t>(std::max(FLAGS_parse_threads, 1)));
+  BinaryEventLogWriter<MidichloriansEvent, MIDICHLORIAN_EVENT_TYPES> writer(fo);
+
+  size_t total_events = 0;
+  size_t total_ticks = 0;
+  LogParsingPipeline<MidichloriansEvent, MidichloriansEventWithTimestamp>::ENTRIES entries;
+  while (pipeline.NextBatch(entries)) {
+    for (const auto& entry : entries) {
+      if (entry->e) {
+        writer.WriteEvent(entry->ms, *entry->e);
+        ++total_events;
+      } else {
+        writer.WriteTick(entry->ms);
+        ++total_ticks;
+      }
+    }
+  }
+  fo.close();
+
+  const size_t total_lines = state.ImmutableScopedAccessor()->total_lines_read;
+  fprintf(stderr,
+          "Done. Read %lu lines, wrote %lu events and %lu ticks into '%s'.\n",
+          total_lines,
+          total_events,
+          total_ticks,
+          FLAGS_output.c_str());
+}
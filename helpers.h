@@ -27,6 +27,9 @@ SOFTWARE.
 #ifndef HELPERS_H
 #define HELPERS_H
 
+#include <tuple>
+#include <typeinfo>
+
 #include "../Current/Bricks/cerealize/cerealize.h"
 #include "../Current/Bricks/strings/printf.h"
 
@@ -39,6 +42,57 @@ std::unique_ptr<T> CloneSerializable(const std::unique_ptr<T, D>& immutable_inpu
   return ParseJSON<std::unique_ptr<T>>(JSON(immutable_input));
 }
 
+template <typename TYPES, size_t I = 0, bool END = (I == std::tuple_size<TYPES>::value)>
+struct PolymorphicCloner {
+  template <typename T>
+  static T* Clone(const T& object) {
+    typedef typename std::tuple_element<I, TYPES>::type U;
+    if (typeid(object) == typeid(U)) {
+      return new U(static_cast<const U&>(object));
+    } else {
+      return PolymorphicCloner<TYPES, I + 1>::Clone(object);
+    }
+  }
+};
+
+template <typename TYPES, size_t I>
+struct PolymorphicCloner<TYPES, I, true> {
+  template <typename T>
+  static T* Clone(const T&) {
+    return nullptr;
+  }
+};
+
+// Deep-copies the object via the copy constructor of its dynamic type, found among `TYPES`.
+// Only the exact dynamic type is matched, so that a type derived from one of `TYPES` does not get sliced;
+// objects of types not in `TYPES` are cloned via the JSON round-trip, as before.
+template <typename TYPES, typename T, typename D>
+std::unique_ptr<T> ClonePolymorphic(const std::unique_ptr<T, D>& immutable_input) {
+  if (!immutable_input) {
+    return nullptr;
+  }
+  T* clone = PolymorphicCloner<TYPES>::Clone(*immutable_input);
+  if (clone) {
+    return std::unique_ptr<T>(clone);
+  } else {
+    return CloneSerializable(immutable_input);
+  }
+}
+
+// The index of type `T` in `std::tuple<TS...>`, at compile time.
+template <typename T, typename TUPLE>
+struct IndexInTuple;
+
+template <typename T, typename... TS>
+struct IndexInTuple<T, std::tuple<T, TS...>> {
+  enum { value = 0 };
+};
+
+template <typename T, typename U, typename... TS>
+struct IndexInTuple<T, std::tuple<U, TS...>> {
+  enum { value = 1 + IndexInTuple<T, std::tuple<TS...>>::value };
+};
+
 inline std::string MillisecondIntervalAsString(uint64_t dt,
                                                const std::string& just_now = "just now",
                                                const std::string& not_just_now_prefix = "") {
@@ -0,0 +1,210 @@
+/*******************************************************************************
+The MIT License (MIT)
+
+Copyright (c) 2015 Dmitry "Dima" Korolev <dmitry.korolev@gmail.com>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*******************************************************************************/
+
+// Ingestion statistics over sliding windows: the last second, minute, five minutes, and hour.
+//
+// Per-second counters live in a ring buffer of atomics, so that updating them from the parsing threads
+// and from the publisher takes no locks. The first writer in a new second claims its slot and clears it;
+// a writer racing with the clearing may lose its increment, which is acceptable for statistics.
+
+#ifndef INGESTION_STATS_H
+#define INGESTION_STATS_H
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "../Current/Bricks/cerealize/cerealize.h"
+#include "../Current/Bricks/time/chrono.h"
+
+// Why an input line did not make it into an entry.
+enum class LogLineError { NONE, MALFORMED_RECORD, MALFORMED_BODY };
+
+inline const char* LogLineErrorAsString(LogLineError error) {
+  switch (error) {
+    case LogLineError::NONE:
+      return "none";
+    case LogLineError::MALFORMED_RECORD:
+      return "malformed_record";
+    case LogLineError::MALFORMED_BODY:
+      return "malformed_body";
+  }
+  return "unknown";
+}
+
+class IngestionStats {
+ public:
+  enum Counter { EVENTS, TICKS, RECORD_PARSE_ERRORS, BODY_PARSE_ERRORS, BYTES, COUNTERS };
+  enum { kMaxWindowSeconds = 3600, kBadLinesToKeep = 16, kMaxBadLineLength = 1000 };
+
+  explicit IngestionStats(uint64_t start_ms = NowMs()) : start_second_(start_ms / 1000) {
+    for (auto& slot : slots_) {
+      slot.second.store(0, std::memory_order_relaxed);
+      for (auto& counter : slot.counters) {
+        counter.store(0, std::memory_order_relaxed);
+      }
+    }
+  }
+
+  static uint64_t NowMs() { return static_cast<uint64_t>(bricks::time::Now()); }
+
+  void Add(Counter counter, uint64_t value, uint64_t now_ms = NowMs()) {
+    if (!value) {
+      return;
+    }
+    const uint64_t second = now_ms / 1000;
+    Slot& slot = slots_[second % kSlots];
+    uint64_t slot_second = slot.second.load(std::memory_order_acquire);
+    while (slot_second != second) {
+      if (slot_second > second) {
+        return;  // The clock went back by over an hour. Drop the value.
+      }
+      if (slot.second.compare_exchange_weak(slot_second, second, std::memory_order_acq_rel)) {
+        for (auto& c : slot.counters) {
+          c.store(0, std::memory_order_relaxed);
+        }
+        break;
+      }
+    }
+    slot.counters[counter].fetch_add(value, std::memory_order_relaxed);
+  }
+
+  // The total over the last `seconds` complete seconds.
+  uint64_t Sum(Counter counter, uint64_t seconds, uint64_t now_ms = NowMs()) const {
+    const uint64_t current_second = now_ms / 1000;
+    seconds = std::min(seconds, std::min(static_cast<uint64_t>(kMaxWindowSeconds), current_second));
+    uint64_t sum = 0;
+    for (uint64_t second = current_second - seconds; second < current_second; ++second) {
+      const Slot& slot = slots_[second % kSlots];
+      if (slot.second.load(std::memory_order_acquire) == second) {
+        sum += slot.counters[counter].load(std::memory_order_relaxed);
+      }
+    }
+    return sum;
+  }
+
+  // Keeps the last few lines that failed to parse, truncated, for `/stats`. Only called on errors.
+  void RecordBadLine(LogLineError error, const char* begin, const char* end, uint64_t now_ms = NowMs()) {
+    BadLine bad_line;
+    bad_line.ms = now_ms;
+    bad_line.error = LogLineErrorAsString(error);
+    const size_t length = static_cast<size_t>(end - begin);
+    bad_line.line.assign(begin, std::min(length, static_cast<size_t>(kMaxBadLineLength)));
+    bad_line.truncated = (length > kMaxBadLineLength);
+    std::lock_guard<std::mutex> lock(bad_lines_mutex_);
+    bad_lines_.push_back(std::move(bad_line));
+    if (bad_lines_.size() > kBadLinesToKeep) {
+      bad_lines_.pop_front();
+    }
+  }
+
+  struct WindowRates {
+    std::string window;
+    uint64_t seconds;  // The seconds the rates are over: the window, or the uptime, if it is shorter.
+    double events_per_second;
+    double ticks_per_second;
+    double record_parse_errors_per_second;
+    double body_parse_errors_per_second;
+    double bytes_per_second;
+    template <typename A>
+    void save(A& ar) const {
+      ar(CEREAL_NVP(window),
+         CEREAL_NVP(seconds),
+         CEREAL_NVP(events_per_second),
+         CEREAL_NVP(ticks_per_second),
+         CEREAL_NVP(record_parse_errors_per_second),
+         CEREAL_NVP(body_parse_errors_per_second),
+         CEREAL_NVP(bytes_per_second));
+    }
+  };
+
+  struct BadLine {
+    uint64_t ms;
+    std::string error;
+    std::string line;
+    bool truncated;
+    template <typename A>
+    void save(A& ar) const {
+      ar(CEREAL_NVP(ms), CEREAL_NVP(error), CEREAL_NVP(line), CEREAL_NVP(truncated));
+    }
+  };
+
+  WindowRates Rates(const std::string& window, uint64_t seconds, uint64_t now_ms) const {
+    WindowRates rates;
+    rates.window = window;
+    // Until the window is full, spreading its counts over all of it would understate the rates.
+    // The uptime is in complete seconds, including the one the stats were created in.
+    const uint64_t current_second = now_ms / 1000;
+    const uint64_t uptime = current_second > start_second_ ? current_second - start_second_ : 0u;
+    seconds = std::max(std::min(seconds, uptime), static_cast<uint64_t>(1u));
+    rates.seconds = seconds;
+    const double k = 1.0 / seconds;
+    rates.events_per_second = k * Sum(EVENTS, seconds, now_ms);
+    rates.ticks_per_second = k * Sum(TICKS, seconds, now_ms);
+    rates.record_parse_errors_per_second = k * Sum(RECORD_PARSE_ERRORS, seconds, now_ms);
+    rates.body_parse_errors_per_second = k * Sum(BODY_PARSE_ERRORS, seconds, now_ms);
+    rates.bytes_per_second = k * Sum(BYTES, seconds, now_ms);
+    return rates;
+  }
+
+  template <typename A>
+  void save(A& ar) const {
+    const uint64_t now_ms = NowMs();
+    std::vector<WindowRates> windows;
+    windows.push_back(Rates("1s", 1, now_ms));
+    windows.push_back(Rates("1m", 60, now_ms));
+    windows.push_back(Rates("5m", 300, now_ms));
+    windows.push_back(Rates("1h", 3600, now_ms));
+    std::vector<BadLine> bad_lines;
+    {
+      std::lock_guard<std::mutex> lock(bad_lines_mutex_);
+      bad_lines.assign(bad_lines_.rbegin(), bad_lines_.rend());  // Most recent first.
+    }
+    ar(CEREAL_NVP(windows), CEREAL_NVP(bad_lines));
+  }
+
+ private:
+  IngestionStats(const IngestionStats&) = delete;
+  void operator=(const IngestionStats&) = delete;
+
+  // One extra slot for the current, incomplete, second, and one more for the margin.
+  enum { kSlots = kMaxWindowSeconds + 2 };
+
+  struct Slot {
+    std::atomic<uint64_t> second;
+    std::atomic<uint64_t> counters[COUNTERS];
+  };
+
+  const uint64_t start_second_;
+  Slot slots_[kSlots];
+
+  mutable std::mutex bad_lines_mutex_;
+  std::deque<BadLine> bad_lines_;
+};
+
+#endif  // INGESTION_STATS_H
@@ -290,6 +290,9 @@ struct MutualInformation : AbstractBase {
 
 };  // namespace insight
 
+// The types of insights, for `ClonePolymorphic()`.
+typedef std::tuple<insight::MutualInformation> INSIGHT_TYPES;
+
 struct InsightsOutput {
   std::map<std::string, TagInfo> tag;
   std::map<std::string, FeatureInfo> feature;
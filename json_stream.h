@@ -0,0 +1,179 @@
+/*******************************************************************************
+The MIT License (MIT)
+
+Copyright (c) 2015 Dmitry "Dima" Korolev <dmitry.korolev@gmail.com>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*******************************************************************************/
+
+// Streaming JSON, for the responses too large to build in memory first, sent with chunked transfer encoding.
+//
+// The output is the very same as that of `JSON()`, byte for byte: it is written by one cereal archive, only the
+// caller walks the object, say, a Yoda accessor, field by field and element by element, rather than having the
+// whole object to serialize at once. The archive writes into a buffer of a fixed size, passed on to the sink,
+// such as `response.Send()`, each time it fills up. So the memory used is that of the buffer, plus the element
+// being serialized. Polymorphic types get the same IDs as with `JSON()` too, as it is the same archive.
+
+#ifndef JSON_STREAM_H
+#define JSON_STREAM_H
+
+#include <algorithm>
+#include <cassert>
+#include <functional>
+#include <memory>
+#include <ostream>
+#include <streambuf>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "../Current/Bricks/cerealize/cerealize.h"
+
+// An `std::streambuf` passing what is written into it on to `sink`, in chunks of `chunk_size` bytes.
+class ChunkedStreamBuffer : public std::streambuf {
+ public:
+  typedef std::function<void(const std::string&)> SINK;
+
+  enum { kDefaultChunkSize = 64 * 1024 };
+
+  explicit ChunkedStreamBuffer(SINK sink, size_t chunk_size = kDefaultChunkSize)
+      : sink_(std::move(sink)), buffer_(std::max(chunk_size, static_cast<size_t>(1))) {
+    Reset();
+  }
+
+  // Passes on what has been written so far, if anything.
+  void Flush() {
+    if (pptr() != pbase()) {
+      if (sink_) {
+        sink_(std::string(pbase(), pptr()));
+      }
+      Reset();
+    }
+  }
+
+  // Drops what has not been passed on yet, and whatever is written from now on.
+  void Detach() {
+    sink_ = nullptr;
+    Reset();
+  }
+
+ protected:
+  int_type overflow(int_type c) override {
+    Flush();
+    if (!traits_type::eq_int_type(c, traits_type::eof())) {
+      *pptr() = traits_type::to_char_type(c);
+      pbump(1);
+    }
+    return traits_type::not_eof(c);
+  }
+
+  int sync() override {
+    Flush();
+    return 0;
+  }
+
+ private:
+  void Reset() { setp(&buffer_[0], &buffer_[0] + buffer_.size()); }
+
+  SINK sink_;
+  std::vector<char> buffer_;
+};
+
+// Writes the JSON object the way `JSON()` does, with its fields passed in one by one.
+// `JSON(object)` is `{"value0":<object>}`, so, to stream an object in this format, begin with `"value0"`.
+//
+//   StreamingJSON json([&response](const std::string& chunk) { response.Send(chunk); });
+//   json.BeginObject("value0");
+//   json.BeginArray("sessions");
+//   for (...) { json.Element(session); }
+//   json.EndArray();
+//   json.EndObject();
+//   json.Finish();  // Closes the object, adds the trailing newline, as in HTTP responses, and flushes.
+//
+// Unless `Finish()` is called, say, due to an exception, the rest of the output is dropped, so that whatever
+// consumes it sees it cut short, instead of the malformed JSON closed by the destructor of the archive.
+class StreamingJSON {
+ public:
+  explicit StreamingJSON(ChunkedStreamBuffer::SINK sink,
+                         size_t chunk_size = ChunkedStreamBuffer::kDefaultChunkSize)
+      : buffer_(std::move(sink), chunk_size),
+        stream_(&buffer_),
+        archive_(new cereal::JSONOutputArchive(stream_, cereal::JSONOutputArchive::Options::NoIndent())) {}
+
+  ~StreamingJSON() {
+    buffer_.Detach();
+    archive_ = nullptr;
+  }
+
+  template <typename T>
+  void Field(const std::string& name, const T& value) {
+    (*archive_)(cereal::make_nvp(name.c_str(), value));
+  }
+
+  // The elements of the array are to follow, serialized via `Element()`, or as objects, via `BeginObject()`.
+  void BeginArray(const std::string& name) {
+    archive_->setNextName(name.c_str());
+    archive_->startNode();
+    archive_->makeArray();
+    ++depth_;
+  }
+
+  template <typename T>
+  void Element(const T& value) {
+    (*archive_)(value);
+  }
+
+  // The fields of the object are to follow. Without the name, the object is an element of the array.
+  void BeginObject(const std::string& name) {
+    archive_->setNextName(name.c_str());
+    BeginObject();
+  }
+  void BeginObject() {
+    archive_->startNode();
+    ++depth_;
+  }
+
+  void EndArray() { End(); }
+  void EndObject() { End(); }
+
+  // Passes on what has been written so far, to not hold it back until the buffer is full.
+  void Flush() { buffer_.Flush(); }
+
+  void Finish() {
+    assert(archive_);
+    assert(!depth_);
+    archive_ = nullptr;  // Closes the top-level object.
+    stream_ << '\n';
+    stream_.flush();
+  }
+
+ private:
+  void End() {
+    assert(depth_);
+    archive_->finishNode();
+    --depth_;
+  }
+
+  ChunkedStreamBuffer buffer_;
+  std::ostream stream_;
+  std::unique_ptr<cereal::JSONOutputArchive> archive_;
+  size_t depth_ = 0;
+};
+
+#endif  // JSON_STREAM_H
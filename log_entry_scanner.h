@@ -0,0 +1,370 @@
+/*******************************************************************************
+The MIT License (MIT)
+
+Copyright (c) 2015 Dmitry "Dima" Korolev <dmitry.korolev@gmail.com>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*******************************************************************************/
+
+// Single-pass extraction of the `LogEntry` fields needed for ingestion: `t`, `m`, and the body, `b`.
+//
+// Rationale: The body is the bulk of each log line. Parsing the line as `LogEntry` unescapes the body
+// into a string that is then parsed again; scanning the line once and unescaping the body into a reused
+// buffer makes the body go through the JSON parser exactly once.
+//
+// The scanner is deliberately strict. It checks the JSON grammar of the whole line, and if the line is not
+// valid JSON, or does not look like a flat `LogEntry` record, or has a `t` that is not a `uint64_t`, `Scan()`
+// returns false, and the caller should fall back to the full `ParseJSON()`.
+
+#ifndef LOG_ENTRY_SCANNER_H
+#define LOG_ENTRY_SCANNER_H
+
+#include <cstdint>
+#include <cstring>
+#include <initializer_list>
+#include <string>
+
+struct LogEntryScanner {
+  uint64_t t = 0;
+  std::string m;
+  std::string b;  // Unescaped. The capacity is reused across calls.
+
+  bool Scan(const std::string& line) { return Scan(line.data(), line.data() + line.length()); }
+
+  bool Scan(const char* begin, const char* end) {
+    p_ = begin;
+    end_ = end;
+    containers_.clear();
+    Expect expect = Expect::Value;
+    char key = '\0';  // The field whose value comes next, if it is one of `t`, `m`, and `b`.
+    int fields_depth = -1;
+    bool has_t = false;
+    bool has_m = false;
+    bool has_b = false;
+    while (SkipWhitespace()) {
+      const char c = *p_;
+      const int depth = static_cast<int>(containers_.size());
+      if (expect == Expect::Done) {
+        return false;
+      } else if (expect == Expect::Colon) {
+        if (c != ':') {
+          return false;
+        }
+        ++p_;
+        expect = Expect::Value;
+      } else if (expect == Expect::CommaOrClose) {
+        if (c == ',') {
+          ++p_;
+          expect = (containers_.back() == '{') ? Expect::Key : Expect::Value;
+        } else if (!Close(c, expect)) {
+          return false;
+        }
+      } else if ((expect == Expect::KeyOrClose && c == '}') || (expect == Expect::ValueOrClose && c == ']')) {
+        Close(c, expect);
+      } else if (expect == Expect::Key || expect == Expect::KeyOrClose) {
+        const char* key_begin = p_ + 1;
+        if (c != '"' || !SkipString()) {
+          return false;
+        }
+        const bool one_letter = (p_ - key_begin == 2);
+        key = (one_letter && std::strchr("tmb", *key_begin) && (fields_depth == -1 || fields_depth == depth))
+                  ? *key_begin
+                  : '\0';
+        expect = Expect::Colon;
+      } else {
+        // A value.
+        if (key) {
+          if (key == 't') {
+            if (has_t || !ParseUInt64(t)) {
+              return false;
+            }
+            has_t = true;
+          } else if (c != '"') {
+            return false;
+          } else if (key == 'm') {
+            if (has_m || !ParseString(m)) {
+              return false;
+            }
+            has_m = true;
+          } else {
+            if (has_b || !ParseString(b)) {
+              return false;
+            }
+            has_b = true;
+          }
+          fields_depth = depth;
+          key = '\0';
+          expect = AfterValue();
+        } else if (c == '{' || c == '[') {
+          containers_ += c;
+          ++p_;
+          expect = (c == '{') ? Expect::KeyOrClose : Expect::ValueOrClose;
+        } else if (c == '"') {
+          if (!SkipString()) {
+            return false;
+          }
+          expect = AfterValue();
+        } else {
+          if (!SkipNumber() && !SkipLiteral()) {
+            return false;
+          }
+          expect = AfterValue();
+        }
+      }
+    }
+    return expect == Expect::Done && has_t && has_m && has_b;
+  }
+
+ private:
+  // What the JSON grammar allows next.
+  enum class Expect { Value, ValueOrClose, Key, KeyOrClose, Colon, CommaOrClose, Done };
+
+  bool SkipWhitespace() {
+    while (p_ != end_ && (*p_ == ' ' || *p_ == '\t' || *p_ == '\r' || *p_ == '\n')) {
+      ++p_;
+    }
+    return p_ != end_;
+  }
+
+  // Expects `p_` at the opening quote, leaves it right after the closing one.
+  bool SkipString() {
+    ++p_;
+    while (p_ != end_) {
+      const char* quote_or_backslash = p_;
+      while (quote_or_backslash != end_ && *quote_or_backslash != '"' && *quote_or_backslash != '\\') {
+        ++quote_or_backslash;
+      }
+      if (quote_or_backslash == end_) {
+        break;
+      }
+      p_ = quote_or_backslash + 1;
+      if (*quote_or_backslash == '"') {
+        return true;
+      }
+      if (p_ == end_) {
+        break;
+      }
+      ++p_;
+    }
+    return false;
+  }
+
+  Expect AfterValue() const { return containers_.empty() ? Expect::Done : Expect::CommaOrClose; }
+
+  // Pops the innermost container if `c` closes it.
+  bool Close(char c, Expect& expect) {
+    if (containers_.empty() || c != (containers_.back() == '{' ? '}' : ']')) {
+      return false;
+    }
+    containers_.pop_back();
+    ++p_;
+    expect = AfterValue();
+    return true;
+  }
+
+  // Rejects leading zeros and values that do not fit, so that `Scan()` falls back to `ParseJSON()` for them.
+  bool ParseUInt64(uint64_t& value) {
+    if (p_ == end_ || *p_ < '0' || *p_ > '9') {
+      return false;
+    }
+    value = 0;
+    if (*p_ == '0') {
+      ++p_;
+      return true;
+    }
+    while (p_ != end_ && *p_ >= '0' && *p_ <= '9') {
+      const uint64_t digit = static_cast<uint64_t>(*p_ - '0');
+      if (value > (UINT64_MAX - digit) / 10u) {
+        return false;
+      }
+      value = value * 10u + digit;
+      ++p_;
+    }
+    return true;
+  }
+
+  bool SkipDigits() {
+    const char* const digits_begin = p_;
+    while (p_ != end_ && *p_ >= '0' && *p_ <= '9') {
+      ++p_;
+    }
+    return p_ != digits_begin;
+  }
+
+  // A JSON number: `-?(0|[1-9][0-9]*)(\.[0-9]+)?([eE][+-]?[0-9]+)?`.
+  bool SkipNumber() {
+    const char* const number_begin = p_;
+    if (*p_ == '-') {
+      ++p_;
+    }
+    if (p_ != end_ && *p_ == '0') {
+      ++p_;
+    } else if (p_ == end_ || *p_ < '1' || *p_ > '9' || !SkipDigits()) {
+      p_ = number_begin;
+      return false;
+    }
+    if (p_ != end_ && *p_ == '.') {
+      ++p_;
+      if (!SkipDigits()) {
+        return false;
+      }
+    }
+    if (p_ != end_ && (*p_ == 'e' || *p_ == 'E')) {
+      ++p_;
+      if (p_ != end_ && (*p_ == '+' || *p_ == '-')) {
+        ++p_;
+      }
+      if (!SkipDigits()) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  bool SkipLiteral() {
+    for (const char* literal : {"true", "false", "null"}) {
+      const size_t length = std::strlen(literal);
+      if (static_cast<size_t>(end_ - p_) >= length && !std::memcmp(p_, literal, length)) {
+        p_ += length;
+        return true;
+      }
+    }
+    return false;
+  }
+
+  static int HexDigit(char c) {
+    if (c >= '0' && c <= '9') {
+      return c - '0';
+    } else if (c >= 'a' && c <= 'f') {
+      return c - 'a' + 10;
+    } else if (c >= 'A' && c <= 'F') {
+      return c - 'A' + 10;
+    } else {
+      return -1;
+    }
+  }
+
+  bool ParseHex4(uint32_t& code) {
+    if (end_ - p_ < 4) {
+      return false;
+    }
+    code = 0;
+    for (int i = 0; i < 4; ++i) {
+      const int digit = HexDigit(*p_++);
+      if (digit < 0) {
+        return false;
+      }
+      code = (code << 4) | static_cast<uint32_t>(digit);
+    }
+    return true;
+  }
+
+  static void AppendUTF8(uint32_t code, std::string& output) {
+    if (code < 0x80) {
+      output += static_cast<char>(code);
+    } else if (code < 0x800) {
+      output += static_cast<char>(0xc0 | (code >> 6));
+      output += static_cast<char>(0x80 | (code & 0x3f));
+    } else if (code < 0x10000) {
+      output += static_cast<char>(0xe0 | (code >> 12));
+      output += static_cast<char>(0x80 | ((code >> 6) & 0x3f));
+      output += static_cast<char>(0x80 | (code & 0x3f));
+    } else {
+      output += static_cast<char>(0xf0 | (code >> 18));
+      output += static_cast<char>(0x80 | ((code >> 12) & 0x3f));
+      output += static_cast<char>(0x80 | ((code >> 6) & 0x3f));
+      output += static_cast<char>(0x80 | (code & 0x3f));
+    }
+  }
+
+  // Expects `p_` at the opening quote, unescapes the string into `output`, leaves `p_` after the closing quote.
+  bool ParseString(std::string& output) {
+    output.clear();
+    ++p_;
+    while (p_ != end_) {
+      const char* run_end = p_;
+      while (run_end != end_ && *run_end != '"' && *run_end != '\\') {
+        ++run_end;
+      }
+      output.append(p_, run_end);
+      p_ = run_end;
+      if (p_ == end_) {
+        return false;
+      }
+      if (*p_++ == '"') {
+        return true;
+      }
+      if (p_ == end_) {
+        return false;
+      }
+      const char escaped = *p_++;
+      switch (escaped) {
+        case '"':
+        case '\\':
+        case '/':
+          output += escaped;
+          break;
+        case 'b':
+          output += '\b';
+          break;
+        case 'f':
+          output += '\f';
+          break;
+        case 'n':
+          output += '\n';
+          break;
+        case 'r':
+          output += '\r';
+          break;
+        case 't':
+          output += '\t';
+          break;
+        case 'u': {
+          uint32_t code;
+          if (!ParseHex4(code)) {
+            return false;
+          }
+          if (code >= 0xd800 && code < 0xdc00) {
+            // Surrogate pair.
+            uint32_t low;
+            if (end_ - p_ < 2 || p_[0] != '\\' || p_[1] != 'u') {
+              return false;
+            }
+            p_ += 2;
+            if (!ParseHex4(low) || low < 0xdc00 || low >= 0xe000) {
+              return false;
+            }
+            code = 0x10000 + ((code - 0xd800) << 10) + (low - 0xdc00);
+          }
+          AppendUTF8(code, output);
+          break;
+        }
+        default:
+          return false;
+      }
+    }
+    return false;
+  }
+
+  const char* p_ = nullptr;
+  const char* end_ = nullptr;
+  std::string containers_;  // The opening brackets of the containers `p_` is in. The capacity is reused.
+};
+
+#endif  // LOG_ENTRY_SCANNER_H
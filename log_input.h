@@ -0,0 +1,459 @@
+/*******************************************************************************
+The MIT License (MIT)
+
+Copyright (c) 2015 Dmitry "Dima" Korolev <dmitry.korolev@gmail.com>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*******************************************************************************/
+
+// Sources of input log lines, split into batches for the ingestion pipeline.
+// Lines are handed out as [begin, end) ranges, without the trailing newline, and without copying
+// them one by one: the batch either owns a contiguous copy of the lines, or points into a memory-mapped file.
+// A line reading "STOP" ends the input.
+
+#ifndef LOG_INPUT_H
+#define LOG_INPUT_H
+
+#include <algorithm>
+#include <cerrno>
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <zlib.h>
+
+struct LogLinesBatch {
+  size_t index = 0;
+
+  // Either the batch owns the bytes of its lines in `storage`, or they live in the memory owned by the source.
+  std::string storage;
+  const char* external_base = nullptr;
+
+  // Offsets of the lines, as [begin, end), relative to the base.
+  std::vector<std::pair<size_t, size_t>> lines;
+
+  // The offset in the input right after this batch. Reading can be resumed from it, see `SkipBytes()`.
+  uint64_t end_offset = 0;
+
+  const char* Base() const { return external_base ? external_base : storage.data(); }
+};
+
+class LogLineSource {
+ public:
+  virtual ~LogLineSource() = default;
+  // Fills `batch` with up to `max_lines` lines. Returns false if there is no more input.
+  // Should not block waiting for more lines if some lines are already available.
+  virtual bool ReadBatch(LogLinesBatch& batch, size_t max_lines) = 0;
+};
+
+inline bool IsStopLine(const char* begin, const char* end) {
+  return end - begin == 4 && !std::memcmp(begin, "STOP", 4);
+}
+
+// Splits blocks of input, as they arrive, into lines.
+class BlockLineSource : public LogLineSource {
+ public:
+  // Discards the first `bytes` of the input, to resume reading it from where a previous run stopped.
+  // Should be called before the first `ReadBatch()`.
+  void SkipBytes(uint64_t bytes) { bytes_to_skip_ = bytes; }
+
+  bool ReadBatch(LogLinesBatch& batch, size_t max_lines) override {
+    batch.storage.clear();
+    batch.external_base = nullptr;
+    batch.lines.clear();
+    while (!done_) {
+      if (bytes_to_skip_) {
+        const uint64_t available = buffer_.length() - begin_;
+        const size_t skipped = static_cast<size_t>(std::min(bytes_to_skip_, available));
+        begin_ += skipped;
+        bytes_to_skip_ -= skipped;
+      }
+      // Hand out the complete lines already in the buffer.
+      const char* const base = buffer_.data() + begin_;
+      const char* const end = buffer_.data() + buffer_.length();
+      const char* p = base;
+      while (batch.lines.size() < max_lines && p != end) {
+        const char* newline = static_cast<const char*>(std::memchr(p, '\n', end - p));
+        if (!newline) {
+          if (!eof_) {
+            break;
+          }
+          newline = end;  // The last line, without the trailing newline.
+        }
+        if (IsStopLine(p, newline)) {
+          done_ = true;
+          break;
+        }
+        batch.lines.emplace_back(p - base, newline - base);
+        p = (newline == end) ? end : newline + 1;
+      }
+      if (!batch.lines.empty()) {
+        batch.storage.assign(base, p - base);
+        begin_ += (p - base);
+        batch.end_offset = buffer_offset_ + begin_;
+        return true;
+      }
+      if (eof_ || done_) {
+        break;
+      }
+      // Need more data.
+      if (begin_) {
+        buffer_.erase(0, begin_);
+        buffer_offset_ += begin_;
+        begin_ = 0;
+      }
+      if (!ReadMore(buffer_)) {
+        eof_ = true;
+      }
+    }
+    done_ = true;
+    return false;
+  }
+
+ protected:
+  enum { kBlockSize = 1 << 20 };
+
+  // Appends the next block of input to `buffer`. Returns false at the end of input.
+  // Should return as soon as some data is available, so that `tail -f` input is not delayed.
+  virtual bool ReadMore(std::string& buffer) = 0;
+
+  static ssize_t ReadFromFileDescriptor(int fd, char* buffer, size_t size) {
+    ssize_t bytes_read;
+    do {
+      bytes_read = ::read(fd, buffer, size);
+    } while (bytes_read < 0 && errno == EINTR);
+    return bytes_read;
+  }
+
+ private:
+  std::string buffer_;
+  uint64_t buffer_offset_ = 0;  // The offset of `buffer_` in the input.
+  size_t begin_ = 0;
+  uint64_t bytes_to_skip_ = 0;
+  bool eof_ = false;
+  bool done_ = false;
+};
+
+// Reads lines from a file descriptor, standard input by default, in large blocks, via `read()`.
+class FileDescriptorLineSource : public BlockLineSource {
+ public:
+  explicit FileDescriptorLineSource(int fd = 0) : fd_(fd) {}
+
+ private:
+  bool ReadMore(std::string& buffer) override {
+    const size_t size = buffer.length();
+    buffer.resize(size + kBlockSize);
+    const ssize_t bytes_read = ReadFromFileDescriptor(fd_, &buffer[size], kBlockSize);
+    buffer.resize(size + static_cast<size_t>(std::max(bytes_read, static_cast<ssize_t>(0))));
+    return bytes_read > 0;
+  }
+
+  const int fd_;
+};
+
+inline bool IsGzipFileName(const std::string& file_name) {
+  return file_name.length() > 3 && file_name.compare(file_name.length() - 3, 3, ".gz") == 0;
+}
+
+// Reads lines from a file descriptor, decompressing gzip input on a dedicated thread, so that decompression
+// overlaps with parsing. Multi-member gzip input, such as concatenated rotated logs, is supported.
+// Input that does not start with the gzip magic is read directly, as `FileDescriptorLineSource` does.
+//
+// The destructor stops and joins the decompression thread. The thread waits for input via `poll()` on both
+// the input and a pipe, and closing the write end of the pipe wakes it up if it is waiting for more input,
+// for instance after a "STOP" line.
+class GzipLineSource : public BlockLineSource {
+ public:
+  explicit GzipLineSource(int fd = 0, bool close_fd = false) : fd_(fd), close_fd_(close_fd) {
+    if (::pipe(wake_fds_) < 0) {
+      if (close_fd_) {
+        ::close(fd_);
+      }
+      throw std::runtime_error(std::string("Can not create a pipe: ") + std::strerror(errno));
+    }
+  }
+
+  // Opens `file_name` for reading.
+  static int OpenFile(const std::string& file_name) {
+    const int fd = ::open(file_name.c_str(), O_RDONLY);
+    if (fd < 0) {
+      throw std::runtime_error("Can not open `" + file_name + "`: " + std::strerror(errno));
+    }
+    return fd;
+  }
+
+  ~GzipLineSource() {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      stop_ = true;
+    }
+    condition_variable_.notify_all();
+    ::close(wake_fds_[1]);
+    if (thread_.joinable()) {
+      thread_.join();
+    }
+    ::close(wake_fds_[0]);
+    if (close_fd_) {
+      ::close(fd_);
+    }
+  }
+
+ private:
+  enum { kMaxBlocksInFlight = 16 };
+
+  bool ReadMore(std::string& buffer) override {
+    if (!detected_) {
+      // The first two bytes tell gzip from plain input.
+      char header[2];
+      size_t header_bytes = 0;
+      while (header_bytes < 2u) {
+        const ssize_t bytes_read = ReadFromFileDescriptor(fd_, header + header_bytes, 2u - header_bytes);
+        if (bytes_read <= 0) {
+          break;
+        }
+        header_bytes += static_cast<size_t>(bytes_read);
+      }
+      detected_ = true;
+      gzip_ = (header_bytes == 2u && static_cast<uint8_t>(header[0]) == 0x1f &&
+               static_cast<uint8_t>(header[1]) == 0x8b);
+      if (!gzip_) {
+        buffer.append(header, header_bytes);
+        return header_bytes == 2u;
+      }
+      thread_ = std::thread([this]() { DecompressionThread(); });
+    }
+    if (!gzip_) {
+      const size_t size = buffer.length();
+      buffer.resize(size + kBlockSize);
+      const ssize_t bytes_read = ReadFromFileDescriptor(fd_, &buffer[size], kBlockSize);
+      buffer.resize(size + static_cast<size_t>(std::max(bytes_read, static_cast<ssize_t>(0))));
+      return bytes_read > 0;
+    }
+    std::unique_lock<std::mutex> lock(mutex_);
+    condition_variable_.wait(lock, [this] { return !blocks_.empty() || done_; });
+    if (blocks_.empty()) {
+      return false;
+    }
+    buffer.append(blocks_.front());
+    blocks_.pop_front();
+    condition_variable_.notify_all();
+    return true;
+  }
+
+  // Returns false if the source is being destroyed.
+  bool WaitForInput() {
+    pollfd fds[2] = {{fd_, POLLIN, 0}, {wake_fds_[0], POLLIN, 0}};
+    while (::poll(fds, 2, -1) < 0 && errno == EINTR) {
+    }
+    return !fds[1].revents;
+  }
+
+  // Returns false if the source is no longer interested in the data.
+  bool Push(const char* data, size_t size) {
+    if (!size) {
+      return true;
+    }
+    std::unique_lock<std::mutex> lock(mutex_);
+    condition_variable_.wait(lock, [this] { return stop_ || blocks_.size() < kMaxBlocksInFlight; });
+    if (stop_) {
+      return false;
+    }
+    blocks_.emplace_back(data, size);
+    condition_variable_.notify_all();
+    return true;
+  }
+
+  // Starts with the gzip magic, already read by `ReadMore()`.
+  void DecompressionThread() {
+    std::string input(kBlockSize, '\0');
+    std::string output(kBlockSize, '\0');
+    input[0] = static_cast<char>(0x1f);
+    input[1] = static_cast<char>(0x8b);
+    size_t size = 2u;
+    bool in_stream = false;
+    bool ok = true;
+    z_stream z;
+    std::memset(&z, 0, sizeof(z));
+    if (inflateInit2(&z, 16 + MAX_WBITS) != Z_OK) {
+      std::cerr << "Can not initialize zlib.\n";
+      ok = false;
+    }
+    while (ok) {
+      z.next_in = reinterpret_cast<Bytef*>(&input[0]);
+      z.avail_in = static_cast<uInt>(size);
+      while (ok && z.avail_in) {
+        if (!in_stream) {
+          inflateReset(&z);
+          in_stream = true;
+        }
+        z.next_out = reinterpret_cast<Bytef*>(&output[0]);
+        z.avail_out = static_cast<uInt>(kBlockSize);
+        const int result = inflate(&z, Z_NO_FLUSH);
+        if (result != Z_OK && result != Z_STREAM_END && result != Z_BUF_ERROR) {
+          std::cerr << "Gzip input is corrupted: " << (z.msg ? z.msg : "unknown error") << ".\n";
+          ok = false;
+          break;
+        }
+        ok = Push(output.data(), kBlockSize - z.avail_out);
+        if (result == Z_STREAM_END) {
+          in_stream = false;  // Another gzip member may follow.
+        } else if (result == Z_BUF_ERROR) {
+          break;
+        }
+      }
+      if (!ok || !WaitForInput()) {
+        ok = false;
+        break;
+      }
+      const ssize_t bytes_read = ReadFromFileDescriptor(fd_, &input[0], kBlockSize);
+      if (bytes_read <= 0) {
+        break;
+      }
+      size = static_cast<size_t>(bytes_read);
+    }
+    if (ok && in_stream) {
+      std::cerr << "Gzip input is truncated.\n";
+    }
+    inflateEnd(&z);
+    std::lock_guard<std::mutex> lock(mutex_);
+    done_ = true;
+    condition_variable_.notify_all();
+  }
+
+  const int fd_;
+  const bool close_fd_;
+  int wake_fds_[2];  // Closing `wake_fds_[1]` wakes up the decompression thread.
+
+  // Accessed from `ReadMore()` only.
+  bool detected_ = false;
+  bool gzip_ = false;
+
+  std::mutex mutex_;
+  std::condition_variable condition_variable_;
+  std::deque<std::string> blocks_;
+  bool done_ = false;
+  bool stop_ = false;
+
+  std::thread thread_;
+};
+
+// A read-only memory-mapped file.
+class MemoryMappedFile {
+ public:
+  explicit MemoryMappedFile(const std::string& file_name) {
+    fd_ = ::open(file_name.c_str(), O_RDONLY);
+    if (fd_ < 0) {
+      throw std::runtime_error("Can not open `" + file_name + "`: " + std::strerror(errno));
+    }
+    struct stat st;
+    if (::fstat(fd_, &st) < 0) {
+      ::close(fd_);
+      throw std::runtime_error("Can not stat `" + file_name + "`: " + std::strerror(errno));
+    }
+    size_ = static_cast<size_t>(st.st_size);
+    if (size_) {
+      void* mapped = ::mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd_, 0);
+      if (mapped == MAP_FAILED) {
+        ::close(fd_);
+        throw std::runtime_error("Can not mmap `" + file_name + "`: " + std::strerror(errno));
+      }
+      data_ = static_cast<const char*>(mapped);
+      ::madvise(mapped, size_, MADV_SEQUENTIAL);
+    }
+  }
+
+  ~MemoryMappedFile() {
+    if (data_) {
+      ::munmap(const_cast<char*>(data_), size_);
+    }
+    ::close(fd_);
+  }
+
+  const char* Data() const { return data_; }
+  size_t Size() const { return size_; }
+
+ private:
+  MemoryMappedFile(const MemoryMappedFile&) = delete;
+  void operator=(const MemoryMappedFile&) = delete;
+
+  int fd_ = -1;
+  const char* data_ = nullptr;
+  size_t size_ = 0;
+};
+
+// Memory-maps the file, and hands out the lines that begin within [from_offset, to_offset), zero-copy.
+// A line that starts before `to_offset` is returned in full, and a line that starts before `from_offset`
+// is skipped, so that consecutive byte ranges split the file into disjoint sets of lines.
+// `to_offset == 0` stands for the end of the file.
+class MemoryMappedLineSource : public LogLineSource {
+ public:
+  MemoryMappedLineSource(const std::string& file_name, uint64_t from_offset = 0, uint64_t to_offset = 0)
+      : file_(file_name), data_(file_.Data()), size_(file_.Size()) {
+    end_ = (to_offset && to_offset < size_) ? static_cast<size_t>(to_offset) : size_;
+    position_ = std::min(static_cast<size_t>(from_offset), size_);
+    if (position_ && data_[position_ - 1] != '\n') {
+      // Mid-line: this line belongs to the previous range.
+      const char* newline = static_cast<const char*>(std::memchr(data_ + position_, '\n', size_ - position_));
+      position_ = newline ? static_cast<size_t>(newline - data_) + 1 : size_;
+    }
+  }
+
+  bool ReadBatch(LogLinesBatch& batch, size_t max_lines) override {
+    batch.storage.clear();
+    batch.external_base = data_;
+    batch.lines.clear();
+    while (batch.lines.size() < max_lines && position_ < end_) {
+      const char* const begin = data_ + position_;
+      const char* newline = static_cast<const char*>(std::memchr(begin, '\n', size_ - position_));
+      const size_t line_end = newline ? static_cast<size_t>(newline - data_) : size_;
+      if (IsStopLine(begin, data_ + line_end)) {
+        position_ = end_;
+        break;
+      }
+      batch.lines.emplace_back(position_, line_end);
+      position_ = line_end + 1;
+    }
+    batch.end_offset = std::min(position_, size_);
+    return !batch.lines.empty();
+  }
+
+ private:
+  const MemoryMappedFile file_;
+  const char* const data_;
+  const size_t size_;
+  size_t end_ = 0;
+  size_t position_ = 0;
+};
+
+#endif  // LOG_INPUT_H
@@ -0,0 +1,397 @@
+/*******************************************************************************
+The MIT License (MIT)
+
+Copyright (c) 2015 Dmitry "Dima" Korolev <dmitry.korolev@gmail.com>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*******************************************************************************/
+
+// Always-on latency histograms: per HTTP route, per transaction type, and per ingestion stage.
+//
+// Unlike `PROFILER_SCOPE`, which is compiled in on demand and only keeps the totals, these are cheap enough
+// to keep on in production, and keep the distribution, to tell the p50 from the p99 and the p999.
+// The histograms are HDR-style: each power of two is split into 16 linear buckets, so any value is known to
+// within 1/16th, from a nanosecond to some twenty minutes, in a few hundred buckets.
+//
+// Each thread records into its own copy of the histogram, with no locks and no contended cache lines: the
+// counters are atomic only for the readers to see them, and each has one writer. The copies are merged on
+// read, under the lock that only the readers, and the threads recording a metric for the first time, take.
+// Once a thread is over, its copy is handed to the next thread to record the same metric.
+// Only depends on the standard library, as `log_input.h` does, to be usable from each binary.
+
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+// The merged latency histogram of one metric, in nanoseconds.
+class LatencyHistogram {
+ public:
+  enum { kSubBucketBits = 4, kSubBuckets = 1 << kSubBucketBits, kMaxValueBits = 40 };
+  enum { kBuckets = (kMaxValueBits - kSubBucketBits + 1) * kSubBuckets };
+
+  static size_t BucketIndex(uint64_t value) {
+    value = std::min(value, (static_cast<uint64_t>(1) << kMaxValueBits) - 1);
+    if (value < kSubBuckets) {
+      return static_cast<size_t>(value);
+    }
+    const int top_bit = 63 - __builtin_clzll(value);
+    const int shift = top_bit - kSubBucketBits;
+    return static_cast<size_t>((shift + 1) * kSubBuckets + ((value >> shift) - kSubBuckets));
+  }
+
+  // The greatest value that falls into the bucket.
+  static uint64_t BucketUpperBound(size_t index) {
+    if (index < kSubBuckets) {
+      return index;
+    }
+    const int shift = static_cast<int>(index / kSubBuckets) - 1;
+    const uint64_t lower_bound = static_cast<uint64_t>(kSubBuckets + index % kSubBuckets) << shift;
+    return lower_bound + (static_cast<uint64_t>(1) << shift) - 1;
+  }
+
+  std::vector<uint64_t> buckets = std::vector<uint64_t>(kBuckets);
+  uint64_t count = 0;
+  uint64_t sum = 0;
+  uint64_t max = 0;
+
+  // The value at or below which the `quantile` of the values are, to within the width of its bucket.
+  uint64_t Percentile(double quantile) const {
+    if (!count) {
+      return 0;
+    }
+    const uint64_t rank = std::max(static_cast<uint64_t>(quantile * count + 0.5), static_cast<uint64_t>(1));
+    uint64_t seen = 0;
+    for (size_t i = 0; i < buckets.size(); ++i) {
+      seen += buckets[i];
+      if (seen >= rank) {
+        return std::min(BucketUpperBound(i), max);
+      }
+    }
+    return max;
+  }
+
+  double Mean() const { return count ? static_cast<double>(sum) / count : 0.0; }
+};
+
+// One thread's copy of the histogram of one metric.
+class LatencyRecorder {
+ public:
+  LatencyRecorder() {
+    for (auto& bucket : buckets_) {
+      bucket.store(0, std::memory_order_relaxed);
+    }
+  }
+
+  // Only ever called by the thread that owns the recorder, hence no read-modify-write operations.
+  void Record(uint64_t value) {
+    std::atomic<uint64_t>& bucket = buckets_[LatencyHistogram::BucketIndex(value)];
+    bucket.store(bucket.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    sum_.store(sum_.load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+    if (value > max_.load(std::memory_order_relaxed)) {
+      max_.store(value, std::memory_order_relaxed);
+    }
+  }
+
+  void MergeInto(LatencyHistogram& histogram) const {
+    for (size_t i = 0; i < LatencyHistogram::kBuckets; ++i) {
+      const uint64_t n = buckets_[i].load(std::memory_order_relaxed);
+      histogram.buckets[i] += n;
+      histogram.count += n;
+    }
+    histogram.sum += sum_.load(std::memory_order_relaxed);
+    histogram.max = std::max(histogram.max, max_.load(std::memory_order_relaxed));
+  }
+
+ private:
+  LatencyRecorder(const LatencyRecorder&) = delete;
+  void operator=(const LatencyRecorder&) = delete;
+
+  std::atomic<uint64_t> buckets_[LatencyHistogram::kBuckets];
+  std::atomic<uint64_t> sum_{0};
+  std::atomic<uint64_t> max_{0};
+};
+
+// A latency metric, such as the one of an HTTP route, named by its `kind` and `name`. See `Latency()`.
+class LatencyMetric {
+ public:
+  LatencyMetric(size_t id, const std::string& kind, const std::string& name) : id(id), kind(kind), name(name) {}
+
+  const size_t id;  // The index of the metric, for the threads to find their recorders by.
+  const std::string kind;
+  const std::string name;
+
+  inline void Record(uint64_t nanoseconds);
+
+  LatencyHistogram Snapshot() const {
+    LatencyHistogram histogram;
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (const auto& recorder : recorders_) {
+      recorder->MergeInto(histogram);
+    }
+    return histogram;
+  }
+
+  // For `ThreadLatencyRecorders` only.
+  LatencyRecorder* Acquire() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!free_.empty()) {
+      LatencyRecorder* recorder = free_.back();
+      free_.pop_back();
+      return recorder;
+    }
+    recorders_.emplace_back(new LatencyRecorder());
+    return recorders_.back().get();
+  }
+
+  void Release(LatencyRecorder* recorder) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    free_.push_back(recorder);
+  }
+
+ private:
+  LatencyMetric(const LatencyMetric&) = delete;
+  void operator=(const LatencyMetric&) = delete;
+
+  mutable std::mutex mutex_;
+  std::vector<std::unique_ptr<LatencyRecorder>> recorders_;
+  std::vector<LatencyRecorder*> free_;  // The recorders of the threads that are over.
+};
+
+// The recorders of the current thread, by metric ID. Handed back to their metrics once the thread is over.
+class ThreadLatencyRecorders {
+ public:
+  static LatencyRecorder& Get(LatencyMetric& metric) {
+    thread_local ThreadLatencyRecorders thread_recorders;
+    auto& recorders = thread_recorders.recorders_;
+    if (metric.id >= recorders.size()) {
+      recorders.resize(metric.id + 1, std::make_pair(nullptr, nullptr));
+    }
+    auto& slot = recorders[metric.id];
+    if (!slot.second) {
+      slot = std::make_pair(&metric, metric.Acquire());
+    }
+    return *slot.second;
+  }
+
+  ~ThreadLatencyRecorders() {
+    for (const auto& slot : recorders_) {
+      if (slot.second) {
+        slot.first->Release(slot.second);
+      }
+    }
+  }
+
+ private:
+  std::vector<std::pair<LatencyMetric*, LatencyRecorder*>> recorders_;
+};
+
+inline void LatencyMetric::Record(uint64_t nanoseconds) {
+  ThreadLatencyRecorders::Get(*this).Record(nanoseconds);
+}
+
+// All the latency metrics of the binary. Never destroyed, as the threads may record into them until exit.
+class LatencyMetrics {
+ public:
+  static LatencyMetrics& Instance() {
+    static LatencyMetrics* instance = new LatencyMetrics();
+    return *instance;
+  }
+
+  LatencyMetric& Get(const std::string& kind, const std::string& name) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    LatencyMetric*& metric = metrics_[std::make_pair(kind, name)];
+    if (!metric) {
+      metric = new LatencyMetric(next_id_++, kind, name);
+    }
+    return *metric;
+  }
+
+  // Calls `f(metric)` for each metric, ordered by kind, then by name.
+  template <typename F>
+  void ForEach(F&& f) const {
+    std::vector<const LatencyMetric*> metrics;
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      for (const auto& cit : metrics_) {
+        metrics.push_back(cit.second);
+      }
+    }
+    for (const LatencyMetric* metric : metrics) {
+      f(*metric);
+    }
+  }
+
+ private:
+  LatencyMetrics() = default;
+
+  mutable std::mutex mutex_;
+  std::map<std::pair<std::string, std::string>, LatencyMetric*> metrics_;
+  size_t next_id_ = 0;
+};
+
+// The metric of `kind`, such as "http", "transaction" or "ingestion", and `name`, created on first use.
+// Takes a lock, so, on hot paths, keep the reference it returns, say, in a `static`.
+inline LatencyMetric& Latency(const std::string& kind, const std::string& name) {
+  return LatencyMetrics::Instance().Get(kind, name);
+}
+
+// Records the time from its construction to its destruction into `metric`. For transactions, as the first
+// statement of their bodies: `const LatencyScope latency(Latency("transaction", "insights_realm"));`.
+class LatencyScope {
+ public:
+  explicit LatencyScope(LatencyMetric& metric) : metric_(metric), begin_(std::chrono::steady_clock::now()) {}
+  ~LatencyScope() {
+    const auto duration = std::chrono::steady_clock::now() - begin_;
+    metric_.Record(
+        static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(duration).count()));
+  }
+
+ private:
+  LatencyScope(const LatencyScope&) = delete;
+  void operator=(const LatencyScope&) = delete;
+
+  LatencyMetric& metric_;
+  const std::chrono::steady_clock::time_point begin_;
+};
+
+// `f`, with each call timed into `metric`.
+template <typename F>
+class TimedCallable {
+ public:
+  TimedCallable(LatencyMetric& metric, F f) : metric_(&metric), f_(std::move(f)) {}
+
+  template <typename... ARGS>
+  auto operator()(ARGS&&... args) const -> decltype(std::declval<const F&>()(std::forward<ARGS>(args)...)) {
+    const LatencyScope scope(*metric_);
+    return f_(std::forward<ARGS>(args)...);
+  }
+
+ private:
+  LatencyMetric* metric_;
+  F f_;
+};
+
+template <typename F>
+TimedCallable<typename std::decay<F>::type> Timed(LatencyMetric& metric, F&& f) {
+  return TimedCallable<typename std::decay<F>::type>(metric, std::forward<F>(f));
+}
+
+// Registers the HTTP handler on `server`, such as `HTTP(port)`, timed as the "http" metric of its route.
+template <typename SERVER, typename F>
+void RegisterTimed(SERVER&& server, const std::string& route, F&& f) {
+  server.Register(route, Timed(Latency("http", route), std::forward<F>(f)));
+}
+
+// The percentiles reported for each metric.
+struct LatencyPercentile {
+  const char* json_name;
+  const char* quantile;
+  double value;
+};
+
+inline const std::vector<LatencyPercentile>& LatencyPercentiles() {
+  static const std::vector<LatencyPercentile> percentiles = {
+      {"p50_us", "0.5", 0.5}, {"p99_us", "0.99", 0.99}, {"p999_us", "0.999", 0.999}};
+  return percentiles;
+}
+
+inline std::string MetricsEscaped(const std::string& s) {
+  std::string result;
+  for (const char c : s) {
+    if (c == '"' || c == '\\') {
+      result += '\\';
+      result += c;
+    } else if (c == '\n') {
+      result += "\\n";
+    } else if (static_cast<unsigned char>(c) >= 0x20) {
+      result += c;
+    }
+  }
+  return result;
+}
+
+inline std::string MetricsNumber(double value) {
+  char buffer[64];
+  snprintf(buffer, sizeof(buffer), "%.9g", value);
+  return buffer;
+}
+
+// `{"latency":[{"kind":...,"name":...,"count":...,"mean_us":...,"p50_us":...,...,"max_us":...},...]}`.
+inline std::string MetricsAsJSON() {
+  std::string json = "{\"latency\":[";
+  bool first = true;
+  LatencyMetrics::Instance().ForEach([&json, &first](const LatencyMetric& metric) {
+    const LatencyHistogram histogram = metric.Snapshot();
+    json += first ? "{" : ",{";
+    first = false;
+    json += "\"kind\":\"" + MetricsEscaped(metric.kind) + "\",\"name\":\"" + MetricsEscaped(metric.name) + "\"";
+    json += ",\"count\":" + std::to_string(histogram.count);
+    json += ",\"mean_us\":" + MetricsNumber(1e-3 * histogram.Mean());
+    for (const auto& percentile : LatencyPercentiles()) {
+      json += ",\"" + std::string(percentile.json_name) +
+              "\":" + MetricsNumber(1e-3 * histogram.Percentile(percentile.value));
+    }
+    json += ",\"max_us\":" + MetricsNumber(1e-3 * histogram.max) + "}";
+  });
+  return json + "]}\n";
+}
+
+// The Prometheus text exposition format: one summary, `latency_seconds`, labeled by kind and name.
+inline std::string MetricsAsPrometheusText() {
+  std::string text =
+      "# HELP latency_seconds The latencies of HTTP routes, transactions and ingestion stages.\n"
+      "# TYPE latency_seconds summary\n";
+  LatencyMetrics::Instance().ForEach([&text](const LatencyMetric& metric) {
+    const LatencyHistogram histogram = metric.Snapshot();
+    const std::string labels =
+        "kind=\"" + MetricsEscaped(metric.kind) + "\",name=\"" + MetricsEscaped(metric.name) + "\"";
+    for (const auto& percentile : LatencyPercentiles()) {
+      text += "latency_seconds{" + labels + ",quantile=\"" + percentile.quantile + "\"} " +
+              MetricsNumber(1e-9 * histogram.Percentile(percentile.value)) + '\n';
+    }
+    text += "latency_seconds_sum{" + labels + "} " + MetricsNumber(1e-9 * histogram.sum) + '\n';
+    text += "latency_seconds_count{" + labels + "} " + std::to_string(histogram.count) + '\n';
+  });
+  return text;
+}
+
+// Exposes the metrics, as JSON, or, with `?format=prometheus`, as Prometheus text, the way
+// `PROFILER_HTTP_ROUTE` exposes the profile.
+#define METRICS_HTTP_ROUTE(port, route)                                                                    \
+  HTTP(port).Register(route, [](Request r) {                                                               \
+    if (r.url.query["format"] == "prometheus") {                                                           \
+      r(MetricsAsPrometheusText(), HTTPResponseCode.OK, "text/plain; version=0.0.4");                      \
+    } else {                                                                                               \
+      r(MetricsAsJSON(), HTTPResponseCode.OK, "application/json; charset=utf-8");                          \
+    }                                                                                                      \
+  })
+
+#endif  // METRICS_H
@@ -0,0 +1,110 @@
+/*******************************************************************************
+The MIT License (MIT)
+
+Copyright (c) 2015 Dmitry "Dima" Korolev <dmitry.korolev@gmail.com>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*******************************************************************************/
+
+// A cache of the serialized responses of the heavy routes, each valid for one version of the data.
+//
+// The key is the route along with the query, and the version is whatever changes whenever the data behind
+// the response may have, such as the number of entries processed so far. A response is computed at most once
+// per key and version: the concurrent requests for the same key and version wait for the one being computed,
+// rather than each computing its own, and the later ones get it from the cache. So dashboards polling an idle
+// server cost next to nothing. Only the latest version of each key is kept, and only for the `kMaxEntries`
+// most recently requested keys.
+
+#ifndef RESPONSE_CACHE_H
+#define RESPONSE_CACHE_H
+
+#include <exception>
+#include <future>
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+
+class ResponseCache {
+ public:
+  typedef std::shared_ptr<const std::string> RESPONSE;
+
+  enum { kMaxEntries = 1024 };
+
+  // Returns the response for `key` as of `version`, calling `f()` to compute it unless it is already cached
+  // or being computed. Exceptions thrown by `f()` are rethrown to all the callers waiting for it.
+  template <typename F>
+  RESPONSE Get(const std::string& key, const std::string& version, F&& f) {
+    std::promise<RESPONSE> promise;
+    std::shared_future<RESPONSE> future;
+    bool compute = false;
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      auto it = entries_.find(key);
+      if (it == entries_.end()) {
+        if (entries_.size() >= kMaxEntries) {
+          // The waiters hold the futures they need, so the entries can be dropped at any time.
+          entries_.erase(lru_.back());
+          lru_.pop_back();
+        }
+        it = entries_.insert(std::make_pair(key, Entry())).first;
+        lru_.push_front(key);
+        it->second.lru = lru_.begin();
+      } else {
+        lru_.splice(lru_.begin(), lru_, it->second.lru);
+      }
+      Entry& entry = it->second;
+      if (entry.version != version || !entry.response.valid()) {
+        entry.version = version;
+        entry.response = promise.get_future().share();
+        compute = true;
+      }
+      future = entry.response;
+    }
+    if (compute) {
+      try {
+        promise.set_value(std::make_shared<const std::string>(f()));
+      } catch (...) {
+        promise.set_exception(std::current_exception());
+        // Do not cache the failure.
+        std::lock_guard<std::mutex> lock(mutex_);
+        const auto it = entries_.find(key);
+        if (it != entries_.end() && it->second.version == version) {
+          lru_.erase(it->second.lru);
+          entries_.erase(it);
+        }
+      }
+    }
+    return future.get();
+  }
+
+ private:
+  struct Entry {
+    std::string version;
+    std::shared_future<RESPONSE> response;
+    std::list<std::string>::iterator lru;
+  };
+
+  std::mutex mutex_;
+  std::map<std::string, Entry> entries_;
+  std::list<std::string> lru_;  // The keys of `entries_`, the most recently requested first.
+};
+
+#endif  // RESPONSE_CACHE_H
@@ -0,0 +1,626 @@
+/*******************************************************************************
+The MIT License (MIT)
+
+Copyright (c) 2015 Dmitry "Dima" Korolev <dmitry.korolev@gmail.com>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*******************************************************************************/
+
+// The full-text index of events: from lowercased terms to the URI-s of the events and of their groups.
+//
+// The URI-s are interned into dense 32-bit document IDs, and the postings of each term are stored as sorted
+// arrays of these IDs, which are intersected by galloping through the longer one.
+//
+// The index is sharded by the hash of the term. Each shard is a list of immutable segments, replaced as a whole
+// on each update, so that readers load the current list and search it without blocking the writer or each
+// other, read-copy-update style. The writer collects postings into per-shard buffers, and turns them into
+// new segments once enough have accumulated, or once the oldest of them has waited for `kMaxPendingMs`, or on
+// `Publish()`, so that an event is searchable within that time even while the input is replayed at full
+// speed. Like in a binary counter, a new segment is merged with the previous one while it is at least half its
+// size, so that a shard has a logarithmic number of segments, and each posting is copied a logarithmic number
+// of times.
+//
+// The terms of each segment are kept sorted, so that a prefix query, `foo*`, is a range of them, found by
+// binary search rather than by scanning all the terms. With `EnableSubstringSearch()`, each segment also
+// indexes the trigrams of its terms, so that a substring query, `*foo*`, only checks the terms having all the
+// trigrams of `foo`. Without it, and for substrings shorter than a trigram, substring queries are prefix ones.
+//
+// The documents are ranked by recency, that is, by their IDs, which are assigned in the order the documents are
+// first indexed. So the top results of a query are the last IDs of its posting lists, and a page of them is
+// picked off the ends of the lists, without looking at the rest, however many of them there are.
+//
+// There should be one writer at a time, as there is: the listener, from within the DB transactions.
+
+#ifndef SEARCH_INDEX_H
+#define SEARCH_INDEX_H
+
+#include <algorithm>
+#include <cctype>
+#include <cstdint>
+#include <functional>
+#include <iterator>
+#include <map>
+#include <memory>
+#include <string>
+#include <stdexcept>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "types.h"
+
+#include "../Current/Bricks/strings/util.h"
+#include "../Current/Bricks/time/chrono.h"
+
+// The URI-s of the documents by their IDs. The strings never move, so that the readers can access the ones
+// published to them while the writer adds more, and so that the index for interning can point to them.
+class SearchDocuments {
+ public:
+  enum : uint32_t { kChunkSize = 1 << 16, kMaxChunks = 1 << 16 };
+
+  SearchDocuments() : chunks_(kMaxChunks) {}
+
+  // Writer side.
+  uint32_t Intern(const std::string& uri) {
+    // The last ID is never assigned, for it to be the cursor of the first page of search results.
+    if (size_ + 1 == static_cast<uint64_t>(kChunkSize) * kMaxChunks) {
+      throw std::length_error("Too many documents in the search index.");
+    }
+    // Place the candidate into the next slot, for the lookup to not need another copy of it.
+    std::string& slot = Slot(size_);
+    slot = uri;
+    const auto inserted = index_.emplace(&slot, static_cast<uint32_t>(size_));
+    if (inserted.second) {
+      ++size_;
+    } else {
+      slot.clear();
+    }
+    return inserted.first->second;
+  }
+
+  // Writer side.
+  uint32_t size() const { return static_cast<uint32_t>(size_); }
+
+  // Reader side, for the IDs the reader has obtained from the published segments.
+  const std::string& URI(uint32_t id) const { return chunks_[id / kChunkSize][id % kChunkSize]; }
+
+ private:
+  struct Hash {
+    size_t operator()(const std::string* s) const { return std::hash<std::string>()(*s); }
+  };
+  struct Equal {
+    bool operator()(const std::string* lhs, const std::string* rhs) const { return *lhs == *rhs; }
+  };
+
+  std::string& Slot(uint64_t id) {
+    std::unique_ptr<std::string[]>& chunk = chunks_[id / kChunkSize];
+    if (!chunk) {
+      chunk.reset(new std::string[kChunkSize]);
+    }
+    return chunk[id % kChunkSize];
+  }
+
+  std::vector<std::unique_ptr<std::string[]>> chunks_;  // Preallocated, never resized.
+  std::unordered_map<const std::string*, uint32_t, Hash, Equal> index_;
+  uint64_t size_ = 0;
+};
+
+// Sorted posting lists.
+typedef std::vector<uint32_t> POSTINGS;
+
+// The first position in [begin, end) with a value not less than `value`: doubles the step from `begin`, then
+// searches within the last step, in time logarithmic in the distance, rather than in `end - begin`.
+inline const uint32_t* GallopLowerBound(const uint32_t* begin, const uint32_t* end, uint32_t value) {
+  size_t step = 1;
+  const uint32_t* lo = begin;
+  while (lo + step < end && lo[step] < value) {
+    lo += step;
+    step *= 2;
+  }
+  return std::lower_bound(lo, std::min(lo + step + 1, end), value);
+}
+
+// Intersects two posting lists, walking the shorter one and galloping through the longer one.
+inline POSTINGS IntersectPostings(const POSTINGS& a, const POSTINGS& b) {
+  const POSTINGS& shorter = a.size() <= b.size() ? a : b;
+  const POSTINGS& longer = a.size() <= b.size() ? b : a;
+  POSTINGS result;
+  const uint32_t* p = longer.data();
+  const uint32_t* const end = longer.data() + longer.size();
+  for (const uint32_t id : shorter) {
+    p = GallopLowerBound(p, end, id);
+    if (p == end) {
+      break;
+    }
+    if (*p == id) {
+      result.push_back(id);
+      ++p;
+    }
+  }
+  return result;
+}
+
+inline POSTINGS UnitePostings(const POSTINGS& a, const POSTINGS& b) {
+  POSTINGS result;
+  result.reserve(a.size() + b.size());
+  std::set_union(a.begin(), a.end(), b.begin(), b.end(), std::back_inserter(result));
+  return result;
+}
+
+class SearchIndex {
+ public:
+  enum { kNumberOfShards = 16, kMaxPendingPostings = 1 << 16, kMaxPendingMs = 1000 };
+
+  // The postings of one event, to be added to the index at once.
+  struct Batch {
+    std::vector<std::pair<std::string, std::string>> postings;  // { Term, URI }.
+
+    void AddToIndex(const std::string& key, const std::string& value) {
+      for (const auto& term : bricks::strings::Split(bricks::strings::ToLower(key), ::isalnum)) {
+        postings.emplace_back(term, value);
+      }
+    }
+  };
+
+  struct Populator {
+    Batch& batch;
+    const std::string& rhs;
+    Populator(Batch& batch, const std::string& rhs) : batch(batch), rhs(rhs) {}
+    void operator()(iOSIdentifyEvent) {}
+    void operator()(const iOSDeviceInfo& e) {
+      for (const auto& cit : e.info) {
+        batch.AddToIndex(cit.first, rhs);
+        batch.AddToIndex(cit.second, rhs);
+      }
+    }
+    void operator()(const iOSAppLaunchEvent& e) { batch.AddToIndex(e.binary_version, rhs); }
+    void operator()(iOSFirstLaunchEvent) {}
+    void operator()(iOSFocusEvent) {}
+    void operator()(const iOSGenericEvent& e) {
+      batch.AddToIndex(e.event, rhs);
+      batch.AddToIndex(e.source, rhs);
+    }
+    void operator()(const iOSBaseEvent& e) { batch.AddToIndex(e.description, rhs); }
+  };
+
+  // A term of the search query: `foo`, `foo*`, or `*foo*`.
+  struct QueryTerm {
+    enum Kind { Exact, Prefix, Substring };
+    std::string text;
+    Kind kind;
+  };
+
+  static bool IsQueryChar(char c) { return ::isalnum(c) || c == '*'; }
+
+  static std::vector<QueryTerm> ParseQuery(const std::string& query) {
+    std::vector<QueryTerm> result;
+    for (const auto& token : bricks::strings::Split(bricks::strings::ToLower(query), IsQueryChar)) {
+      QueryTerm term;
+      term.kind = token.front() == '*' ? QueryTerm::Substring
+                                       : (token.back() == '*' ? QueryTerm::Prefix : QueryTerm::Exact);
+      std::copy_if(token.begin(), token.end(), std::back_inserter(term.text), ::isalnum);
+      if (!term.text.empty()) {
+        result.push_back(std::move(term));
+      }
+    }
+    return result;
+  }
+
+  SearchIndex() : shards_(kNumberOfShards) {
+    for (auto& shard : shards_) {
+      shard.segments = std::make_shared<const SEGMENTS>();
+    }
+  }
+
+  // Writer side, before anything is added: index the trigrams of the terms, for substring queries.
+  void EnableSubstringSearch() { substring_search_ = true; }
+
+  // Reader side, lock-free: the document IDs of the term, as of the last update.
+  POSTINGS Lookup(const std::string& term) const {
+    return Matches(QueryTerm{term, QueryTerm::Exact}).Materialize();
+  }
+
+  // A page of search results.
+  struct Results {
+    std::vector<std::string> uris;  // The most recently indexed documents first.
+    size_t count_estimate = 0;      // Of all the results, not just of this page. Exact or an overestimate.
+    uint32_t next_cursor = 0;       // To pass as `cursor` for the next page, or zero if there is none.
+  };
+
+  enum : uint32_t { kFirstPage = static_cast<uint32_t>(-1) };
+
+  // Reader side: the URI-s of the documents matching all the terms of the query, at most `limit` of them,
+  // starting right past the `cursor` returned with the previous page. The terms are intersected from the one
+  // with the fewest postings on, so that each step is bounded by the smallest result so far. Terms that match
+  // nothing, or nothing of what the terms before them matched, are ignored. See `ParseQuery()` for the prefix
+  // and substring terms.
+  Results Search(const std::string& query, size_t limit, uint32_t cursor = kFirstPage) const {
+    std::vector<std::pair<size_t, TermMatches>> terms;  // { Total postings, matches }.
+    for (const auto& term : ParseQuery(query)) {
+      TermMatches matches = Matches(term);
+      if (!matches.lists.empty()) {
+        size_t size = 0;
+        for (const POSTINGS* list : matches.lists) {
+          size += list->size();
+        }
+        terms.emplace_back(size, std::move(matches));
+      }
+    }
+    std::stable_sort(terms.begin(), terms.end(), [](const std::pair<size_t, TermMatches>& lhs,
+                                                    const std::pair<size_t, TermMatches>& rhs) {
+      return lhs.first < rhs.first;
+    });
+    // The matches of the first term are only copied if nothing else narrows them down.
+    TermMatches first;
+    POSTINGS current;
+    for (auto& term : terms) {
+      TermMatches& matches = term.second;
+      if (first.lists.empty() && current.empty()) {
+        first = std::move(matches);
+      } else {
+        POSTINGS intersected = Intersect(
+            first.lists.empty() ? std::vector<const POSTINGS*>(1, &current) : first.lists, matches.lists);
+        if (!intersected.empty()) {
+          current.swap(intersected);
+          first = TermMatches();
+        }
+      }
+    }
+    Results result;
+    const std::vector<const POSTINGS*> lists =
+        first.lists.empty() ? std::vector<const POSTINGS*>(1, &current) : first.lists;
+    for (const POSTINGS* list : lists) {
+      result.count_estimate += list->size();
+    }
+    // Merge the lists from their ends, past the cursor, until the page is full.
+    typedef std::pair<const uint32_t*, const uint32_t*> RANGE;  // [begin, end), taken from the end.
+    const auto by_last = [](const RANGE& lhs, const RANGE& rhs) { return lhs.second[-1] < rhs.second[-1]; };
+    std::vector<RANGE> heap;
+    for (const POSTINGS* list : lists) {
+      const uint32_t* begin = list->data();
+      const uint32_t* end = std::lower_bound(begin, begin + list->size(), cursor);
+      if (begin != end) {
+        heap.emplace_back(begin, end);
+      }
+    }
+    std::make_heap(heap.begin(), heap.end(), by_last);
+    const auto pop = [&heap, &by_last]() {
+      std::pop_heap(heap.begin(), heap.end(), by_last);
+      const uint32_t id = *--heap.back().second;
+      if (heap.back().first == heap.back().second) {
+        heap.pop_back();
+      } else {
+        std::push_heap(heap.begin(), heap.end(), by_last);
+      }
+      return id;
+    };
+    uint32_t last = cursor;
+    while (!heap.empty() && result.uris.size() < limit) {
+      const uint32_t id = pop();
+      if (id != last) {
+        result.uris.push_back(documents_.URI(id));
+        last = id;
+      }
+    }
+    while (!heap.empty() && heap.front().second[-1] == last) {
+      pop();
+    }
+    if (!heap.empty()) {
+      result.next_cursor = last;
+    }
+    return result;
+  }
+
+  // Writer side.
+  void Add(Batch&& batch) {
+    for (auto& posting : batch.postings) {
+      shards_[ShardIndex(posting.first)].pending[std::move(posting.first)].push_back(
+          documents_.Intern(posting.second));
+    }
+    if (!pending_postings_) {
+      pending_since_ms_ = static_cast<uint64_t>(bricks::time::Now());
+    }
+    pending_postings_ += batch.postings.size();
+    if (pending_postings_ >= kMaxPendingPostings ||
+        static_cast<uint64_t>(bricks::time::Now()) - pending_since_ms_ >= kMaxPendingMs) {
+      Publish();
+    }
+  }
+
+  // Writer side: makes all the postings added so far visible to the readers.
+  void Publish() {
+    for (auto& shard : shards_) {
+      if (!shard.pending.empty()) {
+        std::shared_ptr<Segment> segment = std::make_shared<Segment>();
+        for (auto& term : shard.pending) {
+          POSTINGS& postings = term.second;
+          std::sort(postings.begin(), postings.end());
+          postings.erase(std::unique(postings.begin(), postings.end()), postings.end());
+          postings.shrink_to_fit();
+          segment->postings += postings.size();
+          segment->terms.emplace_hint(segment->terms.end(), term.first, std::move(postings));
+        }
+        shard.pending.clear();
+        std::vector<std::shared_ptr<const Segment>> segments(*shard.segments);
+        while (!segments.empty() && segment->postings * 2 >= segments.back()->postings) {
+          std::shared_ptr<Segment> merged = std::make_shared<Segment>();
+          merged->MergeFrom(*segments.back());
+          merged->MergeFrom(*segment);
+          segment = merged;
+          segments.pop_back();
+        }
+        if (substring_search_) {
+          segment->IndexTrigrams();
+        }
+        segments.push_back(segment);
+        std::atomic_store(&shard.segments, std::make_shared<const SEGMENTS>(std::move(segments)));
+      }
+    }
+    pending_postings_ = 0;
+  }
+
+ private:
+  // The trigrams point to the terms of their own segment, so a segment is never copied, only merged into.
+  struct Segment {
+    typedef std::vector<const std::string*> TERM_POINTERS;  // Sorted by address.
+
+    std::map<std::string, POSTINGS> terms;
+    std::unordered_map<uint32_t, TERM_POINTERS> trigrams;
+    size_t postings = 0;
+
+    Segment() = default;
+    Segment(const Segment&) = delete;
+
+    void MergeFrom(const Segment& rhs) {
+      for (const auto& term : rhs.terms) {
+        POSTINGS& lhs = terms[term.first];
+        postings -= lhs.size();
+        lhs = lhs.empty() ? term.second : UnitePostings(lhs, term.second);
+        postings += lhs.size();
+      }
+    }
+
+    void IndexTrigrams() {
+      trigrams.clear();
+      for (const auto& term : terms) {
+        const std::string& text = term.first;
+        for (size_t i = 0; i + 3 <= text.length(); ++i) {
+          TERM_POINTERS& pointers = trigrams[Trigram(text, i)];
+          if (pointers.empty() || pointers.back() != &text) {
+            pointers.push_back(&text);
+          }
+        }
+      }
+      for (auto& trigram : trigrams) {
+        std::sort(trigram.second.begin(), trigram.second.end());
+        trigram.second.shrink_to_fit();
+      }
+    }
+
+    // Calls `f(postings)` for each term starting with `prefix`.
+    template <typename F>
+    void ForEachPrefixMatch(const std::string& prefix, F&& f) const {
+      for (auto cit = terms.lower_bound(prefix);
+           cit != terms.end() && cit->first.compare(0, prefix.length(), prefix) == 0;
+           ++cit) {
+        f(cit->second);
+      }
+    }
+
+    // Calls `f(postings)` for each term containing `substring`, which should be at least a trigram long.
+    template <typename F>
+    void ForEachSubstringMatch(const std::string& substring, F&& f) const {
+      TERM_POINTERS candidates;
+      for (size_t i = 0; i + 3 <= substring.length(); ++i) {
+        const auto cit = trigrams.find(Trigram(substring, i));
+        if (cit == trigrams.end()) {
+          return;
+        }
+        if (!i) {
+          candidates = cit->second;
+        } else {
+          TERM_POINTERS narrowed;
+          std::set_intersection(candidates.begin(),
+                                candidates.end(),
+                                cit->second.begin(),
+                                cit->second.end(),
+                                std::back_inserter(narrowed));
+          candidates.swap(narrowed);
+        }
+        if (candidates.empty()) {
+          return;
+        }
+      }
+      for (const std::string* term : candidates) {
+        if (term->find(substring) != std::string::npos) {
+          f(terms.find(*term)->second);
+        }
+      }
+    }
+
+    static uint32_t Trigram(const std::string& s, size_t i) {
+      return (static_cast<uint32_t>(static_cast<uint8_t>(s[i])) << 16) |
+             (static_cast<uint32_t>(static_cast<uint8_t>(s[i + 1])) << 8) | static_cast<uint8_t>(s[i + 2]);
+    }
+  };
+  typedef std::vector<std::shared_ptr<const Segment>> SEGMENTS;
+
+ public:
+  // The index as of some moment, for the checkpoints: the number of documents, and the segments of each shard.
+  // Taking it is cheap, as the segments are immutable and shared, and it is written out later, by any thread,
+  // while the index grows.
+  struct Snapshot {
+    uint32_t documents = 0;
+    std::vector<std::shared_ptr<const SEGMENTS>> shards;
+  };
+
+  // Writer side: publishes the pending postings, and takes the snapshot.
+  Snapshot TakeSnapshot() {
+    Publish();
+    Snapshot snapshot;
+    snapshot.documents = documents_.size();
+    for (const auto& shard : shards_) {
+      snapshot.shards.push_back(std::atomic_load(&shard.segments));
+    }
+    return snapshot;
+  }
+
+  // Any thread: the URI of a document of a snapshot taken.
+  const std::string& URI(uint32_t id) const { return documents_.URI(id); }
+
+  // Any thread: writes the postings of the snapshot, as the document IDs of each term, delta-encoded.
+  // A term may have a list in more than one segment.
+  template <typename WRITER>
+  static void WritePostings(const Snapshot& snapshot, WRITER& writer) {
+    size_t number_of_lists = 0;
+    for (const auto& segments : snapshot.shards) {
+      for (const auto& segment : *segments) {
+        number_of_lists += segment->terms.size();
+      }
+    }
+    writer.Write(number_of_lists);
+    for (const auto& segments : snapshot.shards) {
+      for (const auto& segment : *segments) {
+        for (const auto& term : segment->terms) {
+          writer.Write(term.first);
+          writer.Write(term.second.size());
+          uint32_t previous = 0;
+          for (const uint32_t id : term.second) {
+            writer.Write(id - previous);
+            previous = id;
+          }
+        }
+      }
+    }
+  }
+
+  // Writer side, restoring the snapshot into the empty index: first each document, in the order of their IDs,
+  // for the ranking to survive the restore, then the postings, as written by `WritePostings()`.
+  void RestoreDocument(const std::string& uri) { documents_.Intern(uri); }
+
+  template <typename READER>
+  void RestorePostings(READER& reader) {
+    size_t number_of_lists;
+    reader.Read(number_of_lists);
+    for (size_t i = 0; i < number_of_lists; ++i) {
+      std::string term;
+      size_t size;
+      reader.Read(term);
+      reader.Read(size);
+      POSTINGS& postings = shards_[ShardIndex(term)].pending[term];
+      uint32_t id = 0;
+      for (size_t j = 0; j < size; ++j) {
+        uint32_t delta;
+        reader.Read(delta);
+        id += delta;
+        postings.push_back(id);
+      }
+    }
+    Publish();
+  }
+
+ private:
+  struct Shard {
+    std::shared_ptr<const SEGMENTS> segments;  // Only accessed atomically by the readers.
+    std::map<std::string, POSTINGS> pending;   // Writer only.
+  };
+
+  // The posting lists of a term, one per segment, along with the segments, for them to outlive the lists.
+  // The matches of prefix and substring queries, which span many terms and all the shards, are united upfront.
+  struct TermMatches {
+    std::vector<std::shared_ptr<const SEGMENTS>> segments;
+    std::shared_ptr<POSTINGS> united;
+    std::vector<const POSTINGS*> lists;
+    POSTINGS Materialize() const {
+      POSTINGS result;
+      for (const POSTINGS* list : lists) {
+        result = result.empty() ? *list : UnitePostings(result, *list);
+      }
+      return result;
+    }
+  };
+
+  TermMatches Matches(const QueryTerm& term) const {
+    TermMatches result;
+    if (term.kind == QueryTerm::Exact) {
+      result.segments.push_back(std::atomic_load(&shards_[ShardIndex(term.text)].segments));
+      for (const auto& segment : *result.segments.front()) {
+        const auto cit = segment->terms.find(term.text);
+        if (cit != segment->terms.end()) {
+          result.lists.push_back(&cit->second);
+        }
+      }
+    } else {
+      const bool substring = term.kind == QueryTerm::Substring && substring_search_ && term.text.length() >= 3;
+      std::vector<const POSTINGS*> lists;
+      const auto add = [&lists](const POSTINGS& postings) { lists.push_back(&postings); };
+      for (const auto& shard : shards_) {
+        result.segments.push_back(std::atomic_load(&shard.segments));
+        for (const auto& segment : *result.segments.back()) {
+          if (substring) {
+            segment->ForEachSubstringMatch(term.text, add);
+          } else {
+            segment->ForEachPrefixMatch(term.text, add);
+          }
+        }
+      }
+      if (lists.size() <= 1) {
+        result.lists.swap(lists);
+      } else {
+        result.united = std::make_shared<POSTINGS>(UnitePostingLists(lists));
+        result.lists.push_back(result.united.get());
+      }
+    }
+    return result;
+  }
+
+  // Unites many posting lists at once, rather than pairwise, to not copy the longer ones repeatedly.
+  static POSTINGS UnitePostingLists(const std::vector<const POSTINGS*>& lists) {
+    POSTINGS result;
+    for (const POSTINGS* list : lists) {
+      result.insert(result.end(), list->begin(), list->end());
+    }
+    std::sort(result.begin(), result.end());
+    result.erase(std::unique(result.begin(), result.end()), result.end());
+    return result;
+  }
+
+  static POSTINGS Intersect(const std::vector<const POSTINGS*>& a, const std::vector<const POSTINGS*>& b) {
+    POSTINGS result;
+    for (const POSTINGS* lhs : a) {
+      for (const POSTINGS* rhs : b) {
+        const POSTINGS intersected = IntersectPostings(*lhs, *rhs);
+        if (!intersected.empty()) {
+          result = result.empty() ? intersected : UnitePostings(result, intersected);
+        }
+      }
+    }
+    return result;
+  }
+
+  static size_t ShardIndex(const std::string& term) { return std::hash<std::string>()(term) % kNumberOfShards; }
+
+  SearchDocuments documents_;
+  std::vector<Shard> shards_;
+  size_t pending_postings_ = 0;    // Writer only.
+  uint64_t pending_since_ms_ = 0;  // When the oldest of the pending postings was added. Writer only.
+  bool substring_search_ = false;
+};
+
+#endif  // SEARCH_INDEX_H
@@ -0,0 +1,193 @@
+/*******************************************************************************
+The MIT License (MIT)
+
+Copyright (c) 2015 Dmitry "Dima" Korolev <dmitry.korolev@gmail.com>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*******************************************************************************/
+
+// An append-only on-disk store of finalized sessions, so that they do not stay in memory for the life
+// of the process.
+//
+// Sessions are appended to segment files in the compact binary format, each record with its own string table,
+// so that it can be read on its own. Once a segment grows past the size limit, it is sealed and never written
+// to again. Only the locations of the sessions are kept in memory, indexed by GID and SID, and the sessions
+// are read back from the memory-mapped segments, with the page cache as the cache.
+//
+// The store is a spill area, not a persistent one: it starts empty, removing the segments of the previous run.
+// Not thread-safe, meant to be used from within the DB transactions only.
+
+#ifndef SESSION_STORE_H
+#define SESSION_STORE_H
+
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <map>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "checkpoint.h"
+#include "compact_archive.h"
+#include "log_input.h"
+
+#include "../Current/Bricks/strings/printf.h"
+
+template <typename T>
+class SessionStore {
+ public:
+  // Throws `std::runtime_error` if the segments can not be created.
+  SessionStore(const std::string& dir, uint64_t segment_size) : dir_(dir), segment_size_(segment_size) {
+    for (size_t i = 0; FileExists(SegmentFileName(i)); ++i) {
+      std::remove(SegmentFileName(i).c_str());
+    }
+    StartSegment();
+  }
+
+  // Appends `session`, replacing the previously added one with the same GID and SID, if any.
+  void Add(const T& session) {
+    record_.clear();
+    CompactStringTable strings;
+    SaveCompact(session, record_, strings);
+    header_.clear();
+    AppendVarInt(record_.length(), header_);
+    if (segments_.back()->size &&
+        segments_.back()->size + header_.length() + record_.length() > segment_size_) {
+      StartSegment();
+    }
+    Segment& active = *segments_.back();
+    active.stream.write(header_.data(), header_.length());
+    active.stream.write(record_.data(), record_.length());
+    if (!active.stream) {
+      throw std::runtime_error("Can not write `" + active.file_name + "`.");
+    }
+    const auto inserted = index_[session.gid].emplace(session.sid, Location());
+    if (inserted.second) {
+      ++size_;
+    }
+    Location& location = inserted.first->second;
+    location.segment = static_cast<uint32_t>(segments_.size() - 1);
+    location.offset = active.size + header_.length();
+    location.length = record_.length();
+    active.size += header_.length() + record_.length();
+  }
+
+  size_t size() const { return size_; }
+
+  // Loads the session, returning false if there is no such session.
+  bool Get(const std::string& gid, const std::string& sid, T& session) {
+    const auto cit_gid = index_.find(gid);
+    if (cit_gid != index_.end()) {
+      const auto cit_sid = cit_gid->second.find(sid);
+      if (cit_sid != cit_gid->second.end()) {
+        Load(cit_sid->second, session);
+        return true;
+      }
+    }
+    return false;
+  }
+
+  // Calls `f(session)` for each session, ordered by GID, then by SID.
+  template <typename F>
+  void ForEach(F&& f) {
+    for (const auto& sessions_per_group : index_) {
+      for (const auto& individual_session : sessions_per_group.second) {
+        T session;
+        Load(individual_session.second, session);
+        f(static_cast<const T&>(session));
+      }
+    }
+  }
+
+  // Calls `f(session)` for each session past `{gid, sid}`, in the same order, while it returns true.
+  // Returns false if stopped by `f`. Sessions before the starting point are not loaded.
+  template <typename F>
+  bool ForEachPast(const std::string& gid, const std::string& sid, F&& f) {
+    for (auto cit_gid = index_.lower_bound(gid); cit_gid != index_.end(); ++cit_gid) {
+      const auto& sessions_per_group = cit_gid->second;
+      auto cit_sid = cit_gid->first == gid ? sessions_per_group.upper_bound(sid) : sessions_per_group.begin();
+      for (; cit_sid != sessions_per_group.end(); ++cit_sid) {
+        T session;
+        Load(cit_sid->second, session);
+        if (!f(static_cast<const T&>(session))) {
+          return false;
+        }
+      }
+    }
+    return true;
+  }
+
+ private:
+  struct Location {
+    uint32_t segment = 0;
+    uint64_t offset = 0;
+    uint64_t length = 0;
+  };
+
+  struct Segment {
+    std::string file_name;
+    std::ofstream stream;
+    uint64_t size = 0;
+    std::unique_ptr<MemoryMappedFile> mapped;
+  };
+
+  std::string SegmentFileName(size_t index) const {
+    return dir_ + bricks::strings::Printf("/sessions-%06d.bin", static_cast<int>(index));
+  }
+
+  void StartSegment() {
+    if (!segments_.empty()) {
+      // Seal the previous segment.
+      segments_.back()->stream.close();
+    }
+    segments_.emplace_back(new Segment());
+    Segment& segment = *segments_.back();
+    segment.file_name = SegmentFileName(segments_.size() - 1);
+    segment.stream.open(segment.file_name, std::ios::binary | std::ios::trunc);
+    if (!segment.stream) {
+      throw std::runtime_error("Can not open `" + segment.file_name + "` for writing.");
+    }
+  }
+
+  void Load(const Location& location, T& session) {
+    Segment& segment = *segments_[location.segment];
+    if (!segment.mapped || location.offset + location.length > segment.mapped->Size()) {
+      // Only the active segment can grow past the mapped size.
+      if (segment.stream.is_open()) {
+        segment.stream.flush();
+      }
+      segment.mapped.reset(new MemoryMappedFile(segment.file_name));
+    }
+    const char* begin = segment.mapped->Data() + location.offset;
+    CompactStringTable strings;
+    LoadCompact(session, begin, begin + location.length, strings);
+  }
+
+  const std::string dir_;
+  const uint64_t segment_size_;
+  std::vector<std::unique_ptr<Segment>> segments_;
+  std::map<std::string, std::map<std::string, Location>> index_;  // [gid][sid].
+  size_t size_ = 0;
+  std::string header_;
+  std::string record_;
+};
+
+#endif  // SESSION_STORE_H
@@ -24,7 +24,7 @@ SOFTWARE.
 
 // TODO(dkorolev): Merge repositories and relative paths.
 
-// Parse input events from stdin into a Sherlock stream.
+// Parse input events from stdin, or from a file, into a Sherlock stream.
 // Inject `tick` events based on the timer, not input stream.
 // Note: This should be handled by the server receiving events, and by Sherlock. -- D.K.
 
@@ -32,10 +32,23 @@ SOFTWARE.
 #define STDIN_PARSE_H
 
 #include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
 #include <iostream>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <vector>
 
 #include "types.h"
 #include "helpers.h"
+#include "binary_log.h"
+#include "ingestion_stats.h"
+#include "log_entry_scanner.h"
+#include "log_input.h"
+#include "metrics.h"
 
 #include "../Current/Bricks/dflags/dflags.h"
 #include "../Current/Bricks/strings/printf.h"
@@ -49,7 +62,39 @@ SOFTWARE.
 // Stored log event structure, to parse the JSON-s.
 #include "../Current/EventCollector/event_collector.h"
 
-// Parses events from standard input. Expects them to be of type `LogEntry`,
+// The number of entries of `raw` the listener is done with. The listener sets it as it goes, and the
+// ingestion loop, once it is `max_backlog` entries ahead, waits for it to advance, see `IngestionParams`.
+// The listener only takes the mutex if someone is waiting.
+class ProcessedEntries {
+ public:
+  size_t Get() const { return value_; }
+
+  void Set(size_t value) {
+    value_ = value;
+    if (waiters_) {
+      { std::lock_guard<std::mutex> lock(mutex_); }
+      condition_variable_.notify_all();
+    }
+  }
+
+  // Blocks until at least `value` entries are processed.
+  void WaitFor(size_t value) {
+    ++waiters_;
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      condition_variable_.wait(lock, [this, value] { return value_ >= value; });
+    }
+    --waiters_;
+  }
+
+ private:
+  std::atomic_size_t value_{0};
+  std::atomic_size_t waiters_{0};
+  std::mutex mutex_;
+  std::condition_variable condition_variable_;
+};
+
+// Parses events from standard input or from a file. Expects them to be of type `LogEntry`,
 // see `../Current/EventCollector/event__collector.h`.
 struct State {
   const uint64_t start_ms;
@@ -58,11 +103,28 @@ struct State {
   size_t total_ticks = 0;
   size_t last_stream_entry_index = static_cast<size_t>(-1);
 
+  // Ingestion pipeline stages: reading lines, parsing them, publishing parsed entries.
+  size_t parse_threads = 1;
+  size_t total_lines_read = 0;
+  size_t total_lines_parsed = 0;
+  size_t total_entries_published = 0;
+  size_t total_injected_ticks = 0;
+
+  // Backpressure: published entries the listener has not processed yet, see `IngestionParams`.
+  size_t max_backlog = 0;
+  const ProcessedEntries* processed_entries = nullptr;
+  size_t total_events_shed = 0;
+  uint64_t total_backlog_wait_ms = 0;
+
+  // Rates over sliding windows, and the sample of bad input lines. Owned by the ingestion loop.
+  const IngestionStats* ingestion_stats = nullptr;
+
   State() : start_ms(static_cast<uint64_t>(bricks::time::Now())) {}
 
   template <typename A>
   void save(A& ar) const {
     const uint64_t now_ms = static_cast<uint64_t>(bricks::time::Now());
+    const double uptime_seconds = 1e-3 * std::max(now_ms - start_ms, static_cast<uint64_t>(1));
     ar(cereal::make_nvp("uptime", MillisecondIntervalAsString(now_ms - start_ms)),
        cereal::make_nvp("uptime_ms", now_ms - start_ms),
        CEREAL_NVP(last_event_ms),
@@ -70,31 +132,416 @@ struct State {
        cereal::make_nvp("last_event_age_ms", now_ms - last_event_ms),
        CEREAL_NVP(total_events),
        CEREAL_NVP(total_ticks),
-       CEREAL_NVP(last_stream_entry_index));
+       CEREAL_NVP(last_stream_entry_index),
+       CEREAL_NVP(parse_threads),
+       CEREAL_NVP(total_lines_read),
+       CEREAL_NVP(total_lines_parsed),
+       CEREAL_NVP(total_entries_published),
+       CEREAL_NVP(total_injected_ticks),
+       cereal::make_nvp("lines_read_per_second", total_lines_read / uptime_seconds),
+       cereal::make_nvp("lines_parsed_per_second", total_lines_parsed / uptime_seconds),
+       cereal::make_nvp("entries_published_per_second", total_entries_published / uptime_seconds));
+    if (processed_entries) {
+      const size_t published = last_stream_entry_index + 1;
+      const size_t processed = processed_entries->Get();
+      ar(cereal::make_nvp("backlog", published - std::min(published, processed)),
+         CEREAL_NVP(max_backlog),
+         CEREAL_NVP(total_events_shed),
+         CEREAL_NVP(total_backlog_wait_ms));
+    }
+    if (ingestion_stats) {
+      ar(cereal::make_nvp("sliding_windows", *ingestion_stats));
+    }
   }
 };
 
 typedef sherlock::StreamInstance<EID, sherlock::DEFAULT_PERSISTENCE_LAYER, bricks::DefaultCloner> STREAM_TYPE;
 
+// Parses one input line into an entry. Returns `nullptr` if the line can not be parsed, see `error` for why.
+// The body of the log entry is unescaped once, into the buffer of `scanner`, and parsed once.
+template <typename HTTP_BODY_BASE_TYPE, typename ENTRY_TYPE>
+std::unique_ptr<ENTRY_TYPE> ParseLogLine(const char* begin,
+                                         const char* end,
+                                         LogEntryScanner& scanner,
+                                         LogLineError& error) {
+  std::unique_ptr<HTTP_BODY_BASE_TYPE> log_event;
+  error = LogLineError::NONE;
+  try {
+    if (!scanner.Scan(begin, end)) {
+      // Not a flat `LogEntry` record. Let the full parser handle it, or throw.
+      LogEntry log_entry;
+      ParseJSON(std::string(begin, end), log_entry);
+      scanner.t = log_entry.t;
+      scanner.m = std::move(log_entry.m);
+      scanner.b = std::move(log_entry.b);
+    }
+    const uint64_t timestamp = scanner.t;
+    if (scanner.m == "TICK") {
+      return make_unique<ENTRY_TYPE>(timestamp);
+    } else {
+      try {
+        ParseJSON(scanner.b, log_event);
+        return make_unique<ENTRY_TYPE>(timestamp, std::move(log_event));
+      } catch (const bricks::ParseJSONException&) {
+        error = LogLineError::MALFORMED_BODY;
+      }
+    }
+  } catch (const bricks::ParseJSONException&) {
+    error = LogLineError::MALFORMED_RECORD;
+  }
+  return nullptr;
+}
+
+// A source of entries to publish, in the order of input.
+template <typename ENTRY_TYPE>
+class LogEntriesSource {
+ public:
+  typedef std::vector<std::unique_ptr<ENTRY_TYPE>> ENTRIES;
+  virtual ~LogEntriesSource() = default;
+  // Blocks until the next batch of entries is available. Returns `false` once the input is over.
+  virtual bool NextBatch(ENTRIES& entries) = 0;
+  // The offset in the input right after the last batch returned.
+  virtual uint64_t InputOffset() const = 0;
+};
+
+// The multi-stage ingestion pipeline.
+// 1) The reader thread reads batches of lines from the source, until EOF or "STOP".
+// 2) The pool of `parse_threads` workers parses these batches, in arbitrary order.
+// 3) The sequencer, `NextBatch()`, hands out parsed batches strictly in the order of input.
+// The batches in flight, from read to handed out, are capped both in number and in input bytes, so that
+// a slow publisher, for instance one blocked on the backlog, does not make the read and the parsed data pile
+// up in the parse and the sequencer queues.
+//
+// With a non-zero `tick_interval_ms`, the sequencer also hands out a wall-clock tick whenever no input
+// has arrived for that long, so that sessions keep timing out while the input is idle.
+// The tick goes through the same publishing path as the input, hence no extra locking.
+template <typename HTTP_BODY_BASE_TYPE, typename ENTRY_TYPE>
+class LogParsingPipeline : public LogEntriesSource<ENTRY_TYPE> {
+ public:
+  typedef typename LogEntriesSource<ENTRY_TYPE>::ENTRIES ENTRIES;
+
+  LogParsingPipeline(std::unique_ptr<LogLineSource>&& source,
+                     bricks::WaitableAtomic<State>& state,
+                     IngestionStats& stats,
+                     size_t parse_threads,
+                     uint64_t tick_interval_ms = 0)
+      : source_(std::move(source)),
+        state_(state),
+        stats_(stats),
+        max_batches_in_flight_(kBatchesInFlightPerThread * std::max(parse_threads, size_t(1))),
+        tick_interval_(tick_interval_ms),
+        last_handed_out_(std::chrono::steady_clock::now()) {
+    reader_ = std::thread(&LogParsingPipeline::ReaderThread, this);
+    for (size_t i = 0; i < std::max(parse_threads, size_t(1)); ++i) {
+      workers_.emplace_back(&LogParsingPipeline::WorkerThread, this);
+    }
+  }
+
+  ~LogParsingPipeline() {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      destructing_ = true;
+    }
+    condition_variable_.notify_all();
+    reader_.join();
+    for (auto& worker : workers_) {
+      worker.join();
+    }
+  }
+
+  // Blocks until the next batch, in the order of input, is parsed. Returns `false` once the input is over.
+  bool NextBatch(ENTRIES& entries) override {
+    std::unique_lock<std::mutex> lock(mutex_);
+    const auto ready = [this] {
+      return parsed_.count(next_batch_index_) || (reader_done_ && next_batch_index_ == total_batches_);
+    };
+    if (tick_interval_.count()) {
+      if (!condition_variable_.wait_until(lock, last_handed_out_ + tick_interval_, ready)) {
+        // The input is idle. Tick at the wall clock time, but never back in time.
+        last_entry_ms_ = std::max(last_entry_ms_, static_cast<uint64_t>(bricks::time::Now()));
+        last_handed_out_ = std::chrono::steady_clock::now();
+        lock.unlock();
+        entries.clear();
+        entries.push_back(make_unique<ENTRY_TYPE>(last_entry_ms_));
+        state_.MutableUse([](State& s) { ++s.total_injected_ticks; });
+        return true;
+      }
+    } else {
+      condition_variable_.wait(lock, ready);
+    }
+    const auto cit = parsed_.find(next_batch_index_);
+    if (cit == parsed_.end()) {
+      return false;
+    }
+    entries = std::move(cit->second.entries);
+    input_offset_ = cit->second.end_offset;
+    bytes_in_flight_ -= cit->second.bytes;
+    parsed_.erase(cit);
+    ++next_batch_index_;
+    if (!entries.empty()) {
+      last_entry_ms_ = std::max(last_entry_ms_, entries.back()->ms);
+    }
+    last_handed_out_ = std::chrono::steady_clock::now();
+    condition_variable_.notify_all();
+    return true;
+  }
+
+  uint64_t InputOffset() const override { return input_offset_; }
+
+ private:
+  LogParsingPipeline(const LogParsingPipeline&) = delete;
+  void operator=(const LogParsingPipeline&) = delete;
+
+  enum { kLinesPerBatch = 1000, kBatchesInFlightPerThread = 4 };
+  enum { kMaxBytesInFlight = 64 << 20 };  // Unless there is a single batch in flight.
+
+  struct ParsedBatch {
+    ENTRIES entries;
+    uint64_t end_offset;
+    size_t bytes;
+  };
+
+  size_t BatchesInFlight() const { return total_batches_ - next_batch_index_; }
+
+  bool CanReadMore() const {
+    return BatchesInFlight() < max_batches_in_flight_ &&
+           (bytes_in_flight_ < static_cast<size_t>(kMaxBytesInFlight) || !BatchesInFlight());
+  }
+
+  static size_t BatchBytes(const LogLinesBatch& batch) {
+    return batch.lines.empty() ? 0u : batch.lines.back().second - batch.lines.front().first + 1u;
+  }
+
+  void ReaderThread() {
+    bool done = false;
+    while (!done) {
+      LogLinesBatch batch;
+      done = !source_->ReadBatch(batch, kLinesPerBatch);
+      const size_t lines_read = batch.lines.size();
+      state_.MutableUse([lines_read](State& s) { s.total_lines_read += lines_read; });
+      std::unique_lock<std::mutex> lock(mutex_);
+      condition_variable_.wait(lock, [this] { return destructing_ || CanReadMore(); });
+      if (destructing_) {
+        break;
+      }
+      if (!batch.lines.empty()) {
+        batch.index = total_batches_++;
+        bytes_in_flight_ += BatchBytes(batch);
+        pending_.push_back(std::move(batch));
+      }
+      condition_variable_.notify_all();
+    }
+    std::lock_guard<std::mutex> lock(mutex_);
+    reader_done_ = true;
+    condition_variable_.notify_all();
+  }
+
+  void WorkerThread() {
+    LogEntryScanner scanner;
+    LatencyMetric& parse_latency = Latency("ingestion", "parse");
+    while (true) {
+      LogLinesBatch batch;
+      {
+        std::unique_lock<std::mutex> lock(mutex_);
+        condition_variable_.wait(lock, [this] { return destructing_ || reader_done_ || !pending_.empty(); });
+        if (pending_.empty()) {
+          return;
+        }
+        batch = std::move(pending_.front());
+        pending_.pop_front();
+      }
+      ENTRIES entries;
+      entries.reserve(batch.lines.size());
+      const char* const base = batch.Base();
+      uint64_t bytes = 0;
+      uint64_t errors[3] = {0, 0, 0};
+      for (const auto& line : batch.lines) {
+        const char* const begin = base + line.first;
+        const char* const end = base + line.second;
+        LogLineError error;
+        std::unique_ptr<ENTRY_TYPE> entry;
+        {
+          const LatencyScope latency(parse_latency);
+          entry = ParseLogLine<HTTP_BODY_BASE_TYPE, ENTRY_TYPE>(begin, end, scanner, error);
+        }
+        if (entry) {
+          entries.push_back(std::move(entry));
+        } else {
+          ++errors[static_cast<int>(error)];
+          stats_.RecordBadLine(error, begin, end);
+        }
+        bytes += (line.second - line.first) + 1;
+      }
+      const uint64_t now_ms = IngestionStats::NowMs();
+      stats_.Add(IngestionStats::BYTES, bytes, now_ms);
+      stats_.Add(IngestionStats::RECORD_PARSE_ERRORS,
+                 errors[static_cast<int>(LogLineError::MALFORMED_RECORD)],
+                 now_ms);
+      stats_.Add(
+          IngestionStats::BODY_PARSE_ERRORS, errors[static_cast<int>(LogLineError::MALFORMED_BODY)], now_ms);
+      const size_t lines_parsed = batch.lines.size();
+      state_.MutableUse([lines_parsed](State& s) { s.total_lines_parsed += lines_parsed; });
+      {
+        std::lock_guard<std::mutex> lock(mutex_);
+        ParsedBatch& parsed = parsed_[batch.index];
+        parsed.entries = std::move(entries);
+        parsed.end_offset = batch.end_offset;
+        parsed.bytes = BatchBytes(batch);
+      }
+      condition_variable_.notify_all();
+    }
+  }
+
+  std::unique_ptr<LogLineSource> source_;
+  bricks::WaitableAtomic<State>& state_;
+  IngestionStats& stats_;
+  const size_t max_batches_in_flight_;
+
+  std::mutex mutex_;
+  std::condition_variable condition_variable_;
+  std::deque<LogLinesBatch> pending_;
+  std::map<size_t, ParsedBatch> parsed_;
+  size_t total_batches_ = 0;
+  size_t next_batch_index_ = 0;
+  size_t bytes_in_flight_ = 0;  // The input bytes of the batches read and not handed out yet.
+  bool reader_done_ = false;
+  bool destructing_ = false;
+
+  // Accessed from `NextBatch()` only.
+  uint64_t input_offset_ = 0;
+  const std::chrono::milliseconds tick_interval_;
+  std::chrono::steady_clock::time_point last_handed_out_;
+  uint64_t last_entry_ms_ = 0;
+
+  std::thread reader_;
+  std::vector<std::thread> workers_;
+};
+
+// Replays the binary event log, see `binary_log.h`. No parsing involved, so no extra threads either.
+template <typename HTTP_BODY_BASE_TYPE, typename ENTRY_TYPE>
+class BinaryLogEntriesSource : public LogEntriesSource<ENTRY_TYPE> {
+ public:
+  typedef typename LogEntriesSource<ENTRY_TYPE>::ENTRIES ENTRIES;
+  typedef BinaryEventLogReader<HTTP_BODY_BASE_TYPE, MIDICHLORIAN_EVENT_TYPES> READER;
+
+  BinaryLogEntriesSource(std::unique_ptr<READER> reader,
+                         bricks::WaitableAtomic<State>& state,
+                         IngestionStats& stats)
+      : reader_(std::move(reader)), state_(state), stats_(stats) {}
+
+  bool NextBatch(ENTRIES& entries) override {
+    entries.clear();
+    uint64_t ms;
+    std::unique_ptr<HTTP_BODY_BASE_TYPE> e;
+    const size_t offset = reader_->Offset();
+    try {
+      while (!done_ && entries.size() < kEntriesPerBatch && reader_->Read(ms, e)) {
+        if (e) {
+          entries.push_back(make_unique<ENTRY_TYPE>(ms, std::move(e)));
+        } else {
+          entries.push_back(make_unique<ENTRY_TYPE>(ms));
+        }
+      }
+    } catch (const CompactArchiveException&) {
+      std::cerr << "The binary event log is corrupted at offset " << reader_->Offset() << ", stopping.\n";
+      done_ = true;
+    }
+    stats_.Add(IngestionStats::BYTES, reader_->Offset() - offset);
+    const size_t entries_read = entries.size();
+    state_.MutableUse([entries_read](State& s) {
+      s.total_lines_read += entries_read;
+      s.total_lines_parsed += entries_read;
+    });
+    return !entries.empty();
+  }
+
+  uint64_t InputOffset() const override { return reader_->Offset(); }
+
+ private:
+  enum { kEntriesPerBatch = 1000 };
+  const std::unique_ptr<READER> reader_;
+  bricks::WaitableAtomic<State>& state_;
+  IngestionStats& stats_;
+  bool done_ = false;
+};
+
+// What to do with the input once the listener is `max_backlog` entries behind.
+enum class BacklogPolicy {
+  BLOCK,  // Wait for the listener to catch up. Upstream gets backpressure via the bounded parsing pipeline.
+  SHED    // Drop events, but not ticks, until the listener catches up.
+};
+
+// What to ingest, and how.
+struct IngestionParams {
+  std::unique_ptr<LogLineSource> source;  // The input JSON log lines.
+  // Or, if set, the already opened binary event log to replay instead.
+  std::unique_ptr<BinaryEventLogReader<MidichloriansEvent, MIDICHLORIAN_EVENT_TYPES>> binary_input;
+  size_t parse_threads = 1;
+  uint64_t tick_interval_ms = 0;          // If set, inject wall-clock ticks while the input is idle.
+
+  // Backpressure. Only applied if both `max_backlog` and `processed_entries` are set.
+  // `processed_entries` is the number of entries of `raw` the listener is done with.
+  size_t max_backlog = 0;
+  BacklogPolicy backlog_policy = BacklogPolicy::BLOCK;
+  ProcessedEntries* processed_entries = nullptr;
+
+  // Resuming from a checkpoint: the key of the last entry published before it.
+  uint64_t initial_last_key = 0;
+  // Called after each batch is published, with the total number of entries published to `raw`,
+  // the offset in the input right after the batch, and the key of the last published entry.
+  std::function<void(size_t published_entries, uint64_t input_offset, uint64_t last_key)> batch_published_f;
+};
+
+// The key of the next entry of `raw`, as a microsecond timestamp, given the key of the previous one.
+// Keys must be derived this way both when publishing and when replaying the published entries.
+inline uint64_t NextEntryKey(uint64_t last_key, uint64_t ms, bool is_tick) {
+  // Use microseconds timestamp as log entry key.
+  // Increment it by one in case the millisecond timestamp of the entry is the same.
+  // I think it's safe to assume we're quite a bit under 1M QPS. -- D.K.
+  // TODO(dkorolev): "Time went back" logging.
+  uint64_t key = std::max(last_key + 1, ms * 1000);
+  if (is_tick) {
+    // Make sure ticks end with '999'.
+    // Totally unnecessary, except for convenience and human readability. -- D.K.
+    key = ((key / 1000) * 1000) + 999;
+  }
+  return key;
+}
+
 // `ENTRY_TYPE` should have a two-parameter constructor, from { `timestamp`, `std::move(event)` }.
 template <typename HTTP_BODY_BASE_TYPE, typename ENTRY_TYPE, typename YODA>
-size_t BlockingParseLogEventsAndInjectIdleEventsFromStandardInput(STREAM_TYPE& raw,
-                                                                  YODA& db,
-                                                                  int port = 0,
-                                                                  const std::string& route = "") {
+size_t BlockingParseLogEventsAndInjectIdleEvents(IngestionParams&& params,
+                                                 STREAM_TYPE& raw,
+                                                 YODA& db,
+                                                 int port = 0,
+                                                 const std::string& route = "") {
   // Maintain and report the state.
   bricks::WaitableAtomic<State> state;
+  IngestionStats stats;
+  const size_t parse_threads = params.binary_input ? 0u : params.parse_threads;
+  state.MutableUse([parse_threads, &stats, &params](State& s) {
+    s.parse_threads = parse_threads;
+    s.ingestion_stats = &stats;
+    s.max_backlog = params.max_backlog;
+    s.processed_entries = params.processed_entries;
+  });
   if (port) {
-    HTTP(port)
-        .Register(route + "stats", [&state](Request r) { state.ImmutableUse([&r](const State& s) { r(s); }); });
+    RegisterTimed(HTTP(port), route + "stats", [&state](Request r) {
+      state.ImmutableUse([&r](const State& s) { r(s); });
+    });
   }
 
   // A generic way to publish events, interleaved with ticks.
   typedef std::function<void(std::unique_ptr<ENTRY_TYPE> && )> PUBLISH_F;
-  uint64_t last_key = 0;
-  PUBLISH_F publish_f = [&raw, &db, &last_key, &state](std::unique_ptr<ENTRY_TYPE>&& e0) {
+  uint64_t last_key = params.initial_last_key;
+  size_t published_entries = 0;
+  PUBLISH_F publish_f = [&raw, &db, &last_key, &state, &stats, &published_entries](
+      std::unique_ptr<ENTRY_TYPE>&& e0) {
+    static LatencyMetric& publish_latency = Latency("ingestion", "publish");
+    const LatencyScope latency(publish_latency);
     // Own the event.
     std::unique_ptr<ENTRY_TYPE> e = std::move(e0);
+    stats.Add(e->e ? IngestionStats::EVENTS : IngestionStats::TICKS, 1);
 
     // Update the state.
     state.MutableUse([&e](State& s) {
@@ -106,16 +553,7 @@ size_t BlockingParseLogEventsAndInjectIdleEventsFromStandardInput(STREAM_TYPE& r
       s.last_event_ms = e->ms;
     });
 
-    // Use microseconds timestamp as log entry key.
-    // Increment it by one in case the millisecond timestamp of the entry is the same.
-    // I think it's safe to assume we're quite a bit under 1M QPS. -- D.K.
-    // TODO(dkorolev): "Time went back" logging.
-    last_key = std::max(last_key + 1, e->ms * 1000);
-    if (!e->e) {
-      // Make sure ticks end with '999'.
-      // Totally unnecessary, except for convenience and human readability. -- D.K.
-      last_key = ((last_key / 1000) * 1000) + 999;
-    }
+    last_key = NextEntryKey(last_key, e->ms, !e->e);
     // const auto eid = static_cast<EID>(8e18 + last_key);  // "800*" is our convention. -- D.K.
     const auto eid = static_cast<EID>(last_key);
     e->key = eid;
@@ -127,6 +565,7 @@ size_t BlockingParseLogEventsAndInjectIdleEventsFromStandardInput(STREAM_TYPE& r
 
     // Always publish to the raw stream, be it the event or the tick.
     const size_t stream_entry_index = raw.Publish(eid);
+    published_entries = stream_entry_index + 1;
     state.MutableUse([&stream_entry_index](State& s) {
       assert(s.last_stream_entry_index == static_cast<size_t>(-1) ||
              stream_entry_index > s.last_stream_entry_index);
@@ -134,29 +573,48 @@ size_t BlockingParseLogEventsAndInjectIdleEventsFromStandardInput(STREAM_TYPE& r
     });
   };
 
-  // Parse log events as JSON from standard input until EOF.
-  std::string log_entry_as_string;
-  LogEntry log_entry;
-  std::unique_ptr<HTTP_BODY_BASE_TYPE> log_event;
-  while (std::getline(std::cin, log_entry_as_string)) {
-    if (log_entry_as_string == "STOP") {
-      break;
-    }
-    try {
-      ParseJSON(log_entry_as_string, log_entry);
-      const uint64_t timestamp = log_entry.t;
-      if (log_entry.m == "TICK") {
-        publish_f(make_unique<ENTRY_TYPE>(timestamp));
-      } else {
-        try {
-          ParseJSON(log_entry.b, log_event);
-          publish_f(make_unique<ENTRY_TYPE>(timestamp, std::move(log_event)));
-        } catch (const bricks::ParseJSONException&) {
-          // TODO(dkorolev): Error logging and stats over sliding windows.
+  // Parse log events as JSON from the source until EOF, on `parse_threads` threads,
+  // or read them from the binary event log.
+  // Publish them from this thread, in the order of input, as EID-s and stream indexes depend on it.
+  std::unique_ptr<LogEntriesSource<ENTRY_TYPE>> entries_source;
+  if (!params.binary_input) {
+    entries_source.reset(new LogParsingPipeline<HTTP_BODY_BASE_TYPE, ENTRY_TYPE>(
+        std::move(params.source), state, stats, params.parse_threads, params.tick_interval_ms));
+  } else {
+    entries_source.reset(new BinaryLogEntriesSource<HTTP_BODY_BASE_TYPE, ENTRY_TYPE>(
+        std::move(params.binary_input), state, stats));
+  }
+  // Keep the listener at most `max_backlog` entries behind, so that replays do not run away from it.
+  const bool backpressure = params.max_backlog && params.processed_entries;
+  const auto backlog = [&params, &published_entries]() {
+    return published_entries - std::min(published_entries, params.processed_entries->Get());
+  };
+  typename LogEntriesSource<ENTRY_TYPE>::ENTRIES entries;
+  while (entries_source->NextBatch(entries)) {
+    size_t entries_published = 0;
+    size_t events_shed = 0;
+    uint64_t backlog_wait_ms = 0;
+    for (auto& entry : entries) {
+      if (backpressure && backlog() >= params.max_backlog) {
+        if (params.backlog_policy == BacklogPolicy::BLOCK) {
+          const uint64_t wait_begin_ms = static_cast<uint64_t>(bricks::time::Now());
+          params.processed_entries->WaitFor(published_entries + 1 - params.max_backlog);
+          backlog_wait_ms += static_cast<uint64_t>(bricks::time::Now()) - wait_begin_ms;
+        } else if (entry->e) {
+          ++events_shed;
+          continue;
         }
       }
-    } catch (const bricks::ParseJSONException&) {
-      // TODO(dkorolev): Error logging and stats over sliding windows.
+      publish_f(std::move(entry));
+      ++entries_published;
+    }
+    state.MutableUse([entries_published, events_shed, backlog_wait_ms](State& s) {
+      s.total_entries_published += entries_published;
+      s.total_events_shed += events_shed;
+      s.total_backlog_wait_ms += backlog_wait_ms;
+    });
+    if (params.batch_published_f) {
+      params.batch_published_f(published_entries, entries_source->InputOffset(), last_key);
     }
   }
 
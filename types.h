@@ -25,6 +25,7 @@ SOFTWARE.
 #ifndef TYPES_H
 #define TYPES_H
 
+#include "dispatch.h"
 #include "helpers.h"
 
 #include "../Current/Bricks/template/metaprogramming.h"
@@ -55,6 +56,8 @@ struct EventWithTimestamp : yoda::Padawan {
   EID key = static_cast<EID>(0);
   uint64_t ms = 0;
   std::unique_ptr<E> e;  // If `e` is not set, the event is a metronome tick.
+  // The index of the type of `e` in `MIDICHLORIAN_EVENT_TYPES`, kept in sync with `e` by the methods below.
+  size_t e_type_index = kUnknownTypeIndex;
 
   bricks::time::EPOCH_MILLISECONDS ExtractTimestamp() const {
     return static_cast<bricks::time::EPOCH_MILLISECONDS>(ms);
@@ -64,23 +67,44 @@ struct EventWithTimestamp : yoda::Padawan {
 
   // Real event.
   EventWithTimestamp(uint64_t ms, std::unique_ptr<E>&& e)
-      : key(static_cast<EID>(-1)), ms(ms), e(std::move(e)) {}
+      : key(static_cast<EID>(-1)), ms(ms), e(std::move(e)), e_type_index(TypeIndexOf(this->e)) {}
 
   // Tick event.
   EventWithTimestamp(uint64_t ms) : key(static_cast<EID>(-1)), ms(ms) {}
 
   // C++ logic to avoid / reduce copies.
-  EventWithTimestamp(EventWithTimestamp&& rhs) : key(rhs.key), ms(rhs.ms), e(std::move(rhs.e)) {}
-  EventWithTimestamp(const EventWithTimestamp& rhs) : key(rhs.key), ms(rhs.ms), e(CloneSerializable(rhs.e)) {}
+  EventWithTimestamp(EventWithTimestamp&& rhs)
+      : key(rhs.key), ms(rhs.ms), e(std::move(rhs.e)), e_type_index(rhs.e_type_index) {}
+  EventWithTimestamp(const EventWithTimestamp& rhs)
+      : key(rhs.key),
+        ms(rhs.ms),
+        e(ClonePolymorphic<MIDICHLORIAN_EVENT_TYPES>(rhs.e)),
+        e_type_index(rhs.e_type_index) {}
   void operator=(const EventWithTimestamp& rhs) {
     key = rhs.key;
     ms = rhs.ms;
-    e = CloneSerializable(rhs.e);
+    e = ClonePolymorphic<MIDICHLORIAN_EVENT_TYPES>(rhs.e);
+    e_type_index = rhs.e_type_index;
   }
   void operator=(EventWithTimestamp&& rhs) {
     key = rhs.key;
     ms = rhs.ms;
     e = std::move(rhs.e);
+    e_type_index = rhs.e_type_index;
+  }
+
+  static size_t TypeIndexOf(const std::unique_ptr<E>& e) {
+    return e ? TypeIndex<MIDICHLORIAN_EVENT_TYPES>(*e.get()) : kUnknownTypeIndex;
+  }
+
+  // Calls `f` with the event cast to its exact type. Should only be called for real events, not ticks.
+  // Uses the type index computed once per event, and falls back to `RTTIDynamicCall` for unlisted types.
+  template <typename F>
+  void DispatchEvent(F&& f) const {
+    const E& event = *e.get();
+    if (!DispatchByTypeIndex<MIDICHLORIAN_EVENT_TYPES>(e_type_index, event, f)) {
+      bricks::metaprogramming::RTTIDynamicCall<MIDICHLORIAN_EVENT_TYPES>(event, std::forward<F>(f));
+    }
   }
 
   // Human-friedly representation.
@@ -110,8 +134,7 @@ struct EventWithTimestamp : yoda::Padawan {
         void operator()(const iOSBaseEvent& e) { text = "iOSBaseEvent, `" + e.description + "`"; }
       };
       Describer d;
-      // TODO(dkorolev): Have `RTTIDynamicCall` support `const unique_ptr<>` w/o `*e.get()`.
-      bricks::metaprogramming::RTTIDynamicCall<MIDICHLORIAN_EVENT_TYPES>(*e.get(), d);
+      DispatchEvent(d);
       return d.text;
     }
   }
@@ -162,8 +185,7 @@ struct EventWithTimestamp : yoda::Padawan {
         void operator()(const iOSBaseEvent& e) { gist = "iOSBaseEvent:`" + e.description + "`"; }
       };
       CanonicalDescriber cd;
-      // TODO(dkorolev): Have `RTTIDynamicCall` support `const unique_ptr<>` w/o `*e.get()`.
-      bricks::metaprogramming::RTTIDynamicCall<MIDICHLORIAN_EVENT_TYPES>(*e.get(), cd);
+      DispatchEvent(cd);
       return cd.gist;
     }
   }
@@ -173,6 +195,7 @@ struct EventWithTimestamp : yoda::Padawan {
   void serialize(A& ar) {
     Padawan::serialize(ar);
     ar(CEREAL_NVP(key), CEREAL_NVP(ms), CEREAL_NVP(e));
+    e_type_index = TypeIndexOf(e);
   }
 };
 
@@ -25,8 +25,23 @@ SOFTWARE.
 
 #include <algorithm>
 #include <cctype>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <limits>
+#include <mutex>
+#include <thread>
 
 #include "stdin_parse.h"
+#include "checkpoint.h"
+#include "cube_stats.h"
+#include "event_list.h"
+#include "features.h"
+#include "json_stream.h"
+#include "metrics.h"
+#include "response_cache.h"
+#include "search_index.h"
+#include "session_store.h"
 #include "insights.h"
 #include "cubes.h"
 
@@ -49,10 +64,37 @@ DEFINE_string(output_uri_prefix, "http://localhost", "The prefix for the URI-s o
 DEFINE_bool(enable_graceful_shutdown,
             false,
             "Set to true if the binary is only spawned to generate cube/insights data.");
+DEFINE_int32(parse_threads, 4, "The number of threads to parse input log entries on.");
+DEFINE_string(input,
+              "",
+              "If set, read log entries from this file, memory-mapped, instead of standard input. "
+              "Files ending with `.gz` are decompressed on the fly.");
+DEFINE_uint64(from_offset, 0, "With `--input`, only process the lines starting at or after this byte offset.");
+DEFINE_uint64(to_offset, 0, "With `--input`, only process the lines starting before this byte offset, if set.");
+DEFINE_string(binary_input, "", "If set, replay the binary event log from this file, see `gen_binary_log`.");
+DEFINE_uint64(tick_interval_ms,
+              0,
+              "If set, inject a wall-clock tick whenever the input has been idle for this long, "
+              "so that sessions time out without upstream `TICK`-s. For live input only.");
+DEFINE_uint64(max_backlog, 0, "If set, the most published entries the listener can be behind by.");
+DEFINE_string(backlog_policy, "block", "Once `--max_backlog` is reached, \"block\", or \"shed\" the events.");
+DEFINE_int32(session_shards, 4, "The number of threads to group events into sessions on, sharded by GID.");
+DEFINE_uint64(session_timeout_ms, 10 * 60 * 1000, "End the session of a group after this long w/o events.");
+DEFINE_string(session_store_dir, "", "If set, keep finalized sessions on disk, in this directory, not in RAM.");
+DEFINE_uint64(session_segment_size, 64 << 20, "With `--session_store_dir`, the size of each file, in bytes.");
+DEFINE_uint64(sessions_limit, 1000, "The number of sessions per page of `/s`, unless `limit` is set.");
+DEFINE_uint64(sessions_max_limit, 100000, "The most sessions per page of `/s` a `limit` can request.");
+DEFINE_uint64(cube_recent_sessions, 100000, "The number of recent sessions `/c?since=<cursor>` can return.");
+DEFINE_uint64(search_limit, 100, "The number of search results per page, unless `limit` is set.");
+DEFINE_uint64(search_max_limit, 10000, "The most search results per page a `limit` can request.");
+DEFINE_bool(search_substrings, false, "Index the trigrams of search terms, for `*foo*` to match substrings.");
+DEFINE_string(checkpoint_dir, "", "If set, keep checkpoints in this directory, and resume from the last one.");
+DEFINE_uint64(checkpoint_interval_ms, 60 * 1000, "With `--checkpoint_dir`, how often to take a checkpoint.");
 
 #ifdef PROFILER_ENABLED
 DEFINE_string(profiler_route, "/profile", "The route to expose the performance profile on.");
 #endif
+DEFINE_string(metrics_route, "/metrics", "The route to expose the latency histograms on.");
 
 using bricks::strings::Printf;
 using bricks::strings::ToLower;
@@ -62,50 +104,6 @@ using bricks::strings::FromString;
 using bricks::time::Now;
 using bricks::Singleton;
 using bricks::WaitableAtomic;
-using bricks::metaprogramming::RTTIDynamicCall;
-
-struct SearchIndex {
-  std::map<std::string, std::set<std::string>> terms;
-
-  void AddToIndex(const std::string& key, const std::string& value) {
-    for (const auto& term : Split(ToLower(key), ::isalnum)) {
-      terms[term].insert(value);
-    }
-  }
-
-  template <typename A>
-  void serialize(A& ar) {
-    ar(CEREAL_NVP(terms));
-  }
-
-  struct Populator {
-    typedef std::tuple<iOSIdentifyEvent,
-                       iOSDeviceInfo,
-                       iOSAppLaunchEvent,
-                       iOSFirstLaunchEvent,
-                       iOSFocusEvent,
-                       iOSGenericEvent,
-                       iOSBaseEvent> T_TYPES;
-    SearchIndex& index;
-    const std::string& rhs;
-    Populator(SearchIndex& index, const std::string& rhs) : index(index), rhs(rhs) {}
-    void operator()(iOSIdentifyEvent) {}
-    void operator()(const iOSDeviceInfo& e) {
-      for (const auto cit : e.info) {
-        index.AddToIndex(cit.first, rhs);
-        index.AddToIndex(cit.second, rhs);
-      }
-    }
-    void operator()(const iOSAppLaunchEvent& e) { index.AddToIndex(e.binary_version, rhs); }
-    void operator()(iOSFirstLaunchEvent) {}
-    void operator()(iOSFocusEvent) {}
-    void operator()(const iOSGenericEvent& e) {
-      index.AddToIndex(e.event, rhs);
-      index.AddToIndex(e.source, rhs);
-    }
-    void operator()(const iOSBaseEvent& e) { index.AddToIndex(e.description, rhs); }
-  };
-};
 
 typedef EventWithTimestamp<MidichloriansEvent> MidichloriansEventWithTimestamp;
 CEREAL_REGISTER_TYPE(MidichloriansEventWithTimestamp);
@@ -153,16 +151,17 @@ struct AggregatedSessionInfo : yoda::Padawan {
   size_t number_of_seconds;
 
   // Simple aggregation.
-  std::map<std::string, size_t> counters;
+  FeatureCounters counters;
 
   // Timestamps, first and last.
   uint64_t ms_first;
   uint64_t ms_last;
 
   // Events, because meh. -- D.K.
-  std::vector<uint64_t> events;
+  CompactEventList events;
 
   void Finalize() {
+    events.shrink_to_fit();
     number_of_events = events.size();
     number_of_seconds = (ms_last - ms_first + 1000 - 1) / 1000;
   }
@@ -234,331 +233,1326 @@ struct Splitter {
 
   struct CurrentSessions {
     std::map<std::string, AggregatedSessionInfo> map;
-    void EndTimedOutSessions(const uint64_t ms, typename DB::T_DATA& data) {
+    // Sessions ended, but not yet added to the DB, see `Splitter::FlushFinalizedSessions()`. Not exported.
+    std::vector<AggregatedSessionInfo> finalized;
+
+    // Open sessions ordered by `ms_last`, so that ending timed out ones does not scan them all.
+    // Since events mostly arrive in order, updates insert at the end, with a hint.
+    std::set<std::pair<uint64_t, std::string>> expiry;
+
+    // The SID-s are `K<index>`. Each shard numbers its sessions on its own, taking every `index_step`-th index:
+    // shard `i` of `N` takes 100001 + i, 100001 + i + N, and so on. So the SID-s depend on the input and the
+    // number of shards only, and, with one shard, they are K100001, K100002, ... in the order sessions start.
+    int last_index = 100000;
+    int index_step = 1;
+
+    // Returns the open session of `gid`, starting a new one if needed, with its `ms_last` bumped to `ms`.
+    AggregatedSessionInfo& Touch(const std::string& gid, const uint64_t ms) {
+      AggregatedSessionInfo& session = map[gid];
+      if (session.gid.empty()) {
+        // A new session is to be created.
+        last_index += index_step;
+        session.sid = Printf("K%d", last_index);
+        session.gid = gid;
+        session.ms_first = ms;
+      } else {
+        expiry.erase(std::make_pair(session.ms_last, gid));
+      }
+      session.ms_last = ms;
+      expiry.emplace_hint(expiry.end(), ms, gid);
+      return session;
+    }
+
+    // To be called after `map` is populated directly, as when restoring from a checkpoint.
+    void RebuildExpiryIndex() {
+      expiry.clear();
+      for (const auto& cit : map) {
+        expiry.emplace(cit.second.ms_last, cit.first);
+      }
+    }
+
+    void EndTimedOutSessions(const uint64_t ms) {
       PROFILER_SCOPE("CurrentSessions::EndTimedOutSessions()");
-      std::vector<std::string> sessions_to_end;
-      for (const auto cit : map) {
-        if (ms - cit.second.ms_last > 10 * 60 * 1000) {
-          sessions_to_end.push_back(cit.first);
-        }
+      // As before, sessions with `ms_last` past `ms` are ended too, as `ms - ms_last` wraps around for them.
+      while (!expiry.empty() && ms - expiry.begin()->first > FLAGS_session_timeout_ms) {
+        EndSession(expiry.begin());
       }
-      for (const auto key : sessions_to_end) {
-        AggregatedSessionInfo& session = map[key];
-        session.Finalize();
-        data.Add(session);
-        map.erase(key);
+      while (!expiry.empty() && ms - std::prev(expiry.end())->first > FLAGS_session_timeout_ms) {
+        EndSession(std::prev(expiry.end()));
       }
     }
+
+    void EndSession(std::set<std::pair<uint64_t, std::string>>::iterator it) {
+      const auto cit = map.find(it->second);
+      finalized.push_back(std::move(cit->second));
+      finalized.back().Finalize();
+      map.erase(cit);
+      expiry.erase(it);
+    }
+
     template <typename A>
     void serialize(A& ar) {
       ar(CEREAL_NVP(map));
     }
   };
 
-  struct SessionsPayload {
-    CurrentSessions current;
-    std::map<std::string, std::map<std::string, AggregatedSessionInfo>> finalized;
+  // Sessions are sharded by the hash of GID, each shard grouping its events into sessions on its own thread.
+  // A shard sees the events of its groups in the original order. For the sessions to end exactly when they
+  // would with one shard, each step also carries the earliest and the latest timestamp of the entries
+  // the shard did not see since its previous step: ending timed out sessions at both is equivalent
+  // to ending them at each of these entries.
+  class SessionShard {
+   public:
+    struct Step {
+      uint64_t ms = 0;
+      uint64_t window_min_ms = std::numeric_limits<uint64_t>::max();
+      uint64_t window_max_ms = 0;
+      bool is_tick = true;
+      EID eid = static_cast<EID>(0);
+      uint32_t feature_id = kNoFeature;
+      std::string gid;
+    };
+
+    SessionShard(size_t index, size_t number_of_shards) : thread_(&SessionShard::Thread, this) {
+      current_sessions.MutableUse([index, number_of_shards](CurrentSessions& current) {
+        current.index_step = static_cast<int>(number_of_shards);
+        current.last_index = 100001 + static_cast<int>(index) - current.index_step;
+      });
+    }
+    ~SessionShard() {
+      {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stop_ = true;
+      }
+      cv_.notify_all();
+      thread_.join();
+    }
+
+    void Push(Step&& step) {
+      {
+        std::lock_guard<std::mutex> lock(mutex_);
+        queue_.push_back(std::move(step));
+      }
+      cv_.notify_all();
+    }
+
+    // Waits until all the steps pushed so far are processed.
+    void Drain() {
+      std::unique_lock<std::mutex> lock(mutex_);
+      cv_.wait(lock, [this]() { return queue_.empty() && !busy_; });
+    }
+
+    WaitableAtomic<CurrentSessions> current_sessions;
+    std::atomic_bool has_finalized{false};
+    std::atomic<uint64_t> processed_steps{0};
+
+   private:
+    void Thread() {
+      std::deque<Step> steps;
+      while (true) {
+        {
+          std::unique_lock<std::mutex> lock(mutex_);
+          cv_.wait(lock, [this]() { return stop_ || !queue_.empty(); });
+          if (queue_.empty()) {
+            return;
+          }
+          steps.swap(queue_);
+          busy_ = true;
+        }
+        bool finalized = false;
+        current_sessions.MutableUse([&steps, &finalized](CurrentSessions& current) {
+          for (const Step& step : steps) {
+            if (step.window_min_ms <= step.window_max_ms) {
+              current.EndTimedOutSessions(step.window_max_ms);
+              current.EndTimedOutSessions(step.window_min_ms);
+            }
+            current.EndTimedOutSessions(step.ms);
+            if (!step.is_tick) {
+              AggregatedSessionInfo& s = current.Touch(step.gid, step.ms);
+              if (step.feature_id != kNoFeature) {
+                s.counters.Increment(step.feature_id);
+              }
+              s.events.push_back(static_cast<uint64_t>(step.eid));
+            }
+          }
+          finalized = !current.finalized.empty();
+        });
+        processed_steps += steps.size();
+        steps.clear();
+        if (finalized) {
+          has_finalized = true;
+        }
+        {
+          std::lock_guard<std::mutex> lock(mutex_);
+          busy_ = false;
+        }
+        cv_.notify_all();
+      }
+    }
+
+    std::mutex mutex_;
+    std::condition_variable cv_;
+    std::deque<Step> queue_;
+    bool busy_ = false;
+    bool stop_ = false;
+    std::thread thread_;  // Last, to start once the rest is initialized.
+  };
+
+  // The sessions browser, `/s`, lists the open sessions, then a page of the finalized ones, ordered by GID,
+  // then by SID. The page is collected by a series of short transactions, each resuming past the last session
+  // the previous one looked at, and each chunk is sent out as soon as it is collected. So neither is the
+  // ingestion paused for long, nor is the whole response ever held in memory.
+  enum { kSessionsPerChunk = 100, kSessionsScannedPerChunk = 10000 };
+  // Same for the exports of all the finalized sessions, `/i` and `/c`, which have no filters to scan past.
+  enum { kSessionsExportedPerChunk = 1000 };
+
+  // `/s?gid=<GID>&from_ms=<MS>&to_ms=<MS>&fields=summary&limit=<N>&cursor=<C>`, all optional.
+  struct SessionsQuery {
+    std::string gid;  // Only the sessions of this group, if set.
+    uint64_t from_ms = 0;
+    uint64_t to_ms = std::numeric_limits<uint64_t>::max();  // Only the sessions overlapping [from_ms, to_ms].
+    bool summary = false;                                   // `fields=summary`, to omit the events.
+    size_t limit;
+    bool first_page;
+    // The cursor is the last session looked at, as "<GID>/<SID>". SID-s have no slashes, GID-s may.
+    std::string cursor_gid;
+    std::string cursor_sid;
+
+    template <typename Q>
+    explicit SessionsQuery(Q& query)
+        : gid(query["gid"]), summary(query["fields"] == "summary") {
+      const std::string& from_ms_string = query["from_ms"];
+      if (!from_ms_string.empty()) {
+        from_ms = FromString<uint64_t>(from_ms_string);
+      }
+      const std::string& to_ms_string = query["to_ms"];
+      if (!to_ms_string.empty()) {
+        to_ms = FromString<uint64_t>(to_ms_string);
+      }
+      const std::string& limit_string = query["limit"];
+      limit = std::min(
+          static_cast<size_t>(limit_string.empty() ? FLAGS_sessions_limit : FromString<uint64_t>(limit_string)),
+          static_cast<size_t>(FLAGS_sessions_max_limit));
+      const std::string& cursor = query["cursor"];
+      first_page = cursor.empty();
+      const size_t slash = cursor.rfind('/');
+      if (slash != std::string::npos) {
+        cursor_gid = cursor.substr(0, slash);
+        cursor_sid = cursor.substr(slash + 1);
+      }
+      if (!gid.empty() && cursor_gid < gid) {
+        cursor_gid = gid;
+        cursor_sid.clear();
+      }
+    }
+
+    bool Matches(const AggregatedSessionInfo& session) const {
+      return (gid.empty() || session.gid == gid) && session.ms_last >= from_ms && session.ms_first <= to_ms;
+    }
+  };
+
+  // `fields=summary`: everything but the events.
+  struct SessionSummary {
+    std::string uri;
+    std::string sid;
+    std::string gid;
+    size_t number_of_events;
+    size_t number_of_seconds;
+    const FeatureCounters& counters;
+    uint64_t ms_first;
+    uint64_t ms_last;
+
+    explicit SessionSummary(const AggregatedSessionInfo& session)
+        : uri(session.uri),
+          sid(session.sid),
+          gid(session.gid),
+          number_of_events(session.number_of_events),
+          number_of_seconds(session.number_of_seconds),
+          counters(session.counters),
+          ms_first(session.ms_first),
+          ms_last(session.ms_last) {}
+
     template <typename A>
-    void serialize(A& ar) {
-      ar(CEREAL_NVP(current), CEREAL_NVP(finalized));
+    void save(A& ar) const {
+      ar(CEREAL_NVP(uri),
+         CEREAL_NVP(sid),
+         CEREAL_NVP(gid),
+         CEREAL_NVP(number_of_events),
+         CEREAL_NVP(number_of_seconds),
+         CEREAL_NVP(counters),
+         CEREAL_NVP(ms_first),
+         CEREAL_NVP(ms_last));
     }
   };
 
-  WaitableAtomic<CurrentSessions> current_sessions;
+  static void StreamSession(StreamingJSON& json, const AggregatedSessionInfo& session, bool summary) {
+    if (summary) {
+      json.Element(SessionSummary(session));
+    } else {
+      json.Element(session);
+    }
+  }
+
+  // The order the sessions are finalized in, for the exports streamed in two passes, `/i` and `/c`, to only
+  // list the sessions finalized before their first pass, which describes them. Only the sessions finalized
+  // while some export is in progress are remembered, by GID and SID, and only until no export is.
+  class FinalizationSequence {
+   public:
+    // The sessions finalized while exports are open are remembered, up to this many. Past that, the exports
+    // open are expired, and the sessions are forgotten, for a stalled export to not hold on to ever more.
+    enum { kMaxLateSessions = 100000 };
+
+    // Called by the listener as each session is finalized.
+    void Add(const std::string& gid, const std::string& sid) {
+      std::lock_guard<std::mutex> lock(mutex_);
+      ++last_;
+      if (exports_) {
+        if (late_.size() >= kMaxLateSessions) {
+          late_.clear();
+          ++expirations_;
+        }
+        late_[std::make_pair(gid, sid)] = last_;
+      }
+    }
+
+    // Covers one export: constructed along with its first pass, in the same transaction.
+    class Export {
+     public:
+      explicit Export(FinalizationSequence& sequence)
+          : sequence_(sequence), last_(sequence.Begin(expirations_)) {}
+      ~Export() { sequence_.End(); }
+      // Whether the session was finalized by the time the export has started. Only reliable if the export
+      // is not `Expired()` by the time the answer has been used.
+      bool Includes(const AggregatedSessionInfo& session) const {
+        return sequence_.IsFinalizedBy(session.gid, session.sid, last_);
+      }
+      // Whether too many sessions have been finalized since the export has started, for it to tell them apart.
+      bool Expired() const { return sequence_.expirations_ != expirations_; }
+
+     private:
+      FinalizationSequence& sequence_;
+      uint64_t expirations_;  // Set by `Begin()`, along with `last_`.
+      const uint64_t last_;
+    };
+
+   private:
+    uint64_t Begin(uint64_t& expirations) {
+      std::lock_guard<std::mutex> lock(mutex_);
+      ++exports_;
+      expirations = expirations_;
+      return last_;
+    }
+
+    void End() {
+      std::lock_guard<std::mutex> lock(mutex_);
+      if (!--exports_) {
+        late_.clear();
+      }
+    }
+
+    bool IsFinalizedBy(const std::string& gid, const std::string& sid, uint64_t last) const {
+      std::lock_guard<std::mutex> lock(mutex_);
+      const auto cit = late_.find(std::make_pair(gid, sid));
+      return cit == late_.end() || cit->second <= last;
+    }
+
+    mutable std::mutex mutex_;
+    uint64_t last_ = 0;
+    size_t exports_ = 0;
+    std::map<std::pair<std::string, std::string>, uint64_t> late_;  // { GID, SID } -> sequence number.
+    std::atomic<uint64_t> expirations_{0};
+  };
+
+  // The finalized sessions matching the query past the cursor, collected within one transaction.
+  struct SessionsChunk {
+    std::vector<AggregatedSessionInfo> sessions;
+    bool done = false;  // Whether there are no more sessions past the cursor.
+  };
+
+  std::vector<std::unique_ptr<SessionShard>> shards;
+  // The timestamps of the entries each shard did not see since its last step. Only used within transactions.
+  std::vector<std::pair<uint64_t, uint64_t>> shard_windows;
+
+  size_t ShardIndex(const std::string& gid) const { return std::hash<std::string>()(gid) % shards.size(); }
+
+  // With `--session_store_dir`, finalized sessions are kept on disk, and the DB has none.
+  std::unique_ptr<SessionStore<AggregatedSessionInfo>> session_store;
+  // Otherwise, the groups of the finalized sessions in the DB, ordered, for the exports and the browser
+  // to resume past a cursor without walking the groups before it. Only used within transactions.
+  std::set<std::string> finalized_gids;
+
+  // The histograms for the cube export, kept up to date with the finalized sessions.
+  CubeStats cube_stats;
+
+  // The descriptions of the features of the finalized sessions, for the insights export. Only used within
+  // transactions.
+  InsightsInput::Realm insights_realm;
+
+  FinalizationSequence finalization_sequence;
+
+  // Called for each finalized session, within the transaction it is added to the DB in, if set.
+  std::function<void(const AggregatedSessionInfo&)> finalized_f;
+
+  // The responses of the heavy routes, as of `DataVersion()`.
+  ResponseCache response_cache;
+
+  // Bumped by the listener once it has processed an entry, and once a checkpoint is restored.
+  std::atomic<uint64_t> data_changes{0};
+
+  // Changes whenever the data behind the responses may have: on each change above, and as the shards catch up.
+  std::string DataVersion() const {
+    uint64_t version = data_changes;
+    for (const auto& shard : shards) {
+      version += shard->processed_steps;
+    }
+    return ToString(version);
+  }
+
+  static std::string ETag(const std::string& version) { return '"' + version + '"'; }
+
+  // Responds with "304 Not Modified", and returns true, if the client has the response as of `version` already,
+  // as per its `If-None-Match` header.
+  static bool RespondIfNotModified(Request& r, const std::string& version) {
+    const std::string etag = ETag(version);
+    const auto cit = r.headers.find("If-None-Match");
+    if (cit != r.headers.end() && cit->second == etag) {
+      r("", HTTPResponseCode.NotModified, "application/json; charset=utf-8", HTTPHeaders({{"ETag", etag}}));
+      return true;
+    } else {
+      return false;
+    }
+  }
+
+  // Responds with what `f()` returns, serialized, and cached as of `version`, unless the client has it already.
+  template <typename F>
+  void RespondCached(Request r, const std::string& key, const std::string& version, F&& f) {
+    if (!RespondIfNotModified(r, version)) {
+      const ResponseCache::RESPONSE response =
+          response_cache.Get(key, version, [&f]() { return JSON(f()) + '\n'; });
+      const std::string etag = ETag(version);
+      r(*response, HTTPResponseCode.OK, "application/json; charset=utf-8", HTTPHeaders({{"ETag", etag}}));
+    }
+  }
+
+  void AddFinalizedSession(typename DB::T_DATA& data, const AggregatedSessionInfo& session) {
+    cube_stats.AddSession(session.sid, session.number_of_seconds, session.counters);
+    ExportSessionForInsights(session, &insights_realm, nullptr);
+    finalization_sequence.Add(session.gid, session.sid);
+    if (finalized_f) {
+      finalized_f(session);
+    }
+    if (session_store) {
+      session_store->Add(session);
+    } else {
+      data.Add(session);
+      finalized_gids.insert(session.gid);
+    }
+  }
+
+  // Calls `f(session)` for each finalized session past `{gid, sid}`, ordered by GID, then by SID, while it
+  // returns true. Returns false if stopped by `f`.
+  template <typename F>
+  bool ForEachFinalizedSessionPast(typename DB::T_DATA& data,
+                                   const std::string& gid,
+                                   const std::string& sid,
+                                   F&& f) {
+    const auto& groups = yoda::Matrix<AggregatedSessionInfo>::Accessor(data).Cols();
+    for (auto cit = finalized_gids.lower_bound(gid); cit != finalized_gids.end(); ++cit) {
+      for (const auto& individual_session : groups[*cit]) {
+        const auto& session = static_cast<const AggregatedSessionInfo&>(individual_session);
+        if (session.gid == gid && session.sid <= sid) {
+          continue;
+        }
+        if (!f(session)) {
+          return false;
+        }
+      }
+    }
+    if (session_store) {
+      return session_store->ForEachPast(gid, sid, std::forward<F>(f));
+    }
+    return true;
+  }
+
+  // Collects up to `max_sessions` finalized sessions matching the query past its cursor, advancing the cursor.
+  // Looks at a bounded number of sessions, for the transaction to be short even if few of them match.
+  SessionsChunk NextSessionsChunk(typename DB::T_DATA& data, SessionsQuery& query, size_t max_sessions) {
+    SessionsChunk chunk;
+    bool past_the_group = false;
+    size_t scanned = 0;
+    const bool complete = ForEachFinalizedSessionPast(
+        data,
+        query.cursor_gid,
+        query.cursor_sid,
+        [&query, &chunk, &past_the_group, &scanned, max_sessions](const AggregatedSessionInfo& session) {
+          if (!query.gid.empty() && session.gid != query.gid) {
+            past_the_group = true;
+            return false;
+          }
+          query.cursor_gid = session.gid;
+          query.cursor_sid = session.sid;
+          if (query.Matches(session)) {
+            chunk.sessions.push_back(session);
+          }
+          return ++scanned < kSessionsScannedPerChunk && chunk.sessions.size() < max_sessions;
+        });
+    chunk.done = complete || past_the_group;
+    return chunk;
+  }
+
+  // Calls `f(session)` for each finalized session, in the same order, outside the transactions, while it
+  // returns true. Returns false if stopped by `f`. The sessions are copied out chunk by chunk, each by a short
+  // transaction, resuming past the last session of the previous.
+  template <typename F>
+  bool ForEachFinalizedSessionInChunks(F&& f) {
+    std::string gid;
+    std::string sid;
+    bool done = false;
+    while (!done) {
+      std::vector<AggregatedSessionInfo> sessions;
+      db.Transaction([this, &gid, &sid, &sessions, &done](typename DB::T_DATA data) {
+        const LatencyScope latency(Latency("transaction", "sessions_export_chunk"));
+        done = ForEachFinalizedSessionPast(
+            data, gid, sid, [&gid, &sid, &sessions](const AggregatedSessionInfo& session) {
+              gid = session.gid;
+              sid = session.sid;
+              sessions.push_back(session);
+              return sessions.size() < kSessionsExportedPerChunk;
+            });
+      }).Go();
+      for (const auto& session : sessions) {
+        if (!f(session)) {
+          return false;
+        }
+      }
+    }
+    return true;
+  }
+
+  static const std::vector<int>& InsightsSecondMarks() {
+    static const std::vector<int> second_marks({5, 10, 15, 30, 60, 120, 300});
+    return second_marks;
+  }
+
+  // The one and only realm for insight generation, `/i`, so far, with only the time features yet.
+  static void PrepareInsightsRealm(InsightsInput::Realm& realm) {
+    // TODO(dkorolev): Bracketing, grouping, time windows.
+    realm.description = "One and only realm.";
+    // Explain time features.
+    realm.tag["T"].name = "Session length";
+    for (const auto seconds : InsightsSecondMarks()) {
+      auto& feature = realm.feature[Printf(">=%ds", seconds)];
+      feature.tag = "T";
+      feature.yes = Printf("%d seconds or longer", seconds);
+      feature.no = Printf("under %d seconds", seconds);
+    }
+  }
+
+  // The features of the session for insight generation into `output_session`, and their descriptions into
+  // `realm`, each if not null.
+  static void ExportSessionForInsights(const AggregatedSessionInfo& individual_session,
+                                       InsightsInput::Realm* realm,
+                                       InsightsInput::Session* output_session) {
+    // Emit the information about this session, in a way that makes it
+    // comparable with other sessions within the same realm.
+    if (output_session) {
+      output_session->key = individual_session.sid;
+      const int seconds = static_cast<int>(individual_session.number_of_seconds);
+      for (const auto t : InsightsSecondMarks()) {
+        if (seconds >= t) {
+          output_session->feature.emplace_back(Printf(">=%ds", t));
+        }
+      }
+    }
+    individual_session.counters.ForEachByName([realm, output_session](const std::string& feature,
+                                                                      size_t count) {
+      if (realm) {
+        realm->tag[feature].name = feature;
+        realm->feature[feature].tag = feature;
+        realm->feature[feature].yes = "'" + feature + "'";
+      }
+      if (output_session) {
+        output_session->feature.emplace_back(feature);
+      }
+      for (size_t c = 2; c <= std::min(count, static_cast<size_t>(10)); ++c) {
+        const std::string count_feature = Printf("%s>=%d", feature.c_str(), static_cast<int>(c));
+        if (output_session) {
+          output_session->feature.emplace_back(count_feature);
+        }
+        if (realm) {
+          realm->feature[count_feature].tag = feature;
+          realm->feature[count_feature].yes = Printf("%d or more '%s'", static_cast<int>(c), feature.c_str());
+          realm->feature[count_feature].no =
+              Printf("%d or less '%s'", static_cast<int>(c) - 1, feature.c_str());
+        }
+      }
+    });
+  }
+
+  // Adds the sessions ended by the shards to the DB, or to the session store.
+  void FlushFinalizedSessions(typename DB::T_DATA& data) {
+    for (auto& shard : shards) {
+      if (shard->has_finalized.exchange(false)) {
+        shard->current_sessions.MutableUse([this, &data](CurrentSessions& current) {
+          for (const auto& session : current.finalized) {
+            AddFinalizedSession(data, session);
+          }
+          current.finalized.clear();
+        });
+      }
+    }
+  }
+
+  // Waits for the shards to process all the events so far, and adds the sessions they have ended to the DB.
+  void DrainSessions(typename DB::T_DATA& data) {
+    for (size_t i = 0; i < shards.size(); ++i) {
+      auto& window = shard_windows[i];
+      if (window.first <= window.second) {
+        SessionShard::Step step;
+        step.ms = window.second;
+        step.window_min_ms = window.first;
+        step.window_max_ms = window.second;
+        window = std::make_pair(std::numeric_limits<uint64_t>::max(), 0ull);
+        shards[i]->Push(std::move(step));
+      }
+    }
+    for (auto& shard : shards) {
+      shard->Drain();
+    }
+    FlushFinalizedSessions(data);
+  }
+
+  // All the open sessions, across the shards.
+  CurrentSessions MergedCurrentSessions() {
+    CurrentSessions merged;
+    for (auto& shard : shards) {
+      shard->current_sessions.ImmutableUse([&merged](const CurrentSessions& current) {
+        merged.map.insert(current.map.begin(), current.map.end());
+      });
+    }
+    return merged;
+  }
+
+  // The index of the last SID assigned by each shard.
+  std::vector<int> LastSessionIndexes() {
+    std::vector<int> result;
+    for (auto& shard : shards) {
+      shard->current_sessions.ImmutableUse([&result](const CurrentSessions& current) {
+        result.push_back(current.last_index);
+      });
+    }
+    return result;
+  }
+
+  // Should the number of shards have changed, each shard resumes past the last SID assigned by any.
+  void RestoreCurrentSessions(std::map<std::string, AggregatedSessionInfo>&& map,
+                              const std::vector<int>& last_session_indexes) {
+    std::vector<std::map<std::string, AggregatedSessionInfo>> per_shard(shards.size());
+    for (auto& cit : map) {
+      per_shard[ShardIndex(cit.first)].insert(std::move(cit));
+    }
+    const bool same_shards = last_session_indexes.size() == shards.size();
+    const int last = last_session_indexes.empty()
+                         ? 0
+                         : *std::max_element(last_session_indexes.begin(), last_session_indexes.end());
+    for (size_t i = 0; i < shards.size(); ++i) {
+      shards[i]->current_sessions.MutableUse([&](CurrentSessions& current) {
+        current.map = std::move(per_shard[i]);
+        current.RebuildExpiryIndex();
+        if (same_shards) {
+          current.last_index = last_session_indexes[i];
+        } else if (last > current.last_index) {
+          current.last_index += (last - current.last_index) / current.index_step * current.index_step;
+        }
+      });
+    }
+  }
+
+  explicit Splitter(DB& db) : db(db), cube_stats(FLAGS_cube_recent_sessions) {
+    PrepareInsightsRealm(insights_realm);
+    const size_t number_of_shards = static_cast<size_t>(std::max(FLAGS_session_shards, 1));
+    for (size_t i = 0; i < number_of_shards; ++i) {
+      shards.emplace_back(new SessionShard(i, number_of_shards));
+    }
+    shard_windows.resize(number_of_shards, std::make_pair(std::numeric_limits<uint64_t>::max(), 0ull));
 
-  explicit Splitter(DB& db) : db(db) {
     // Grouped logs browser.
-    HTTP(FLAGS_port).Register(FLAGS_route + "g", [this, &db](Request r) {
-      const std::string& key = r.url.query["gid"];
+    RegisterTimed(HTTP(FLAGS_port), FLAGS_route + "g", [this, &db](Request r) {
+      const std::string key = r.url.query["gid"];
       if (key.empty()) {
-        db.Transaction([](typename DB::T_DATA data) {
-                         SessionsListPayload payload;
-                         for (const auto cit : yoda::Matrix<EventsByGID>::Accessor(data).Rows()) {
-                           payload.sessions.push_back(FLAGS_output_uri_prefix + "/g?gid=" + cit.key());
-                         }
-                         std::sort(std::begin(payload.sessions), std::end(payload.sessions));
-                         return payload;
-                       },
-                       std::move(r));
+        RespondCached(std::move(r), "/g", DataVersion(), [&db]() {
+          SessionsListPayload payload;
+          db.Transaction([&payload](typename DB::T_DATA data) {
+            const LatencyScope latency(Latency("transaction", "groups"));
+            for (const auto cit : yoda::Matrix<EventsByGID>::Accessor(data).Rows()) {
+              payload.sessions.push_back(FLAGS_output_uri_prefix + "/g?gid=" + cit.key());
+            }
+          }).Go();
+          std::sort(std::begin(payload.sessions), std::end(payload.sessions));
+          return payload;
+        });
       } else {
+        // The "time ago"-s are as of the current second.
         const auto now_as_uint64 = static_cast<uint64_t>(Now());
-        db.Transaction(
-            [key, now_as_uint64](typename DB::T_DATA data) {
-              SessionDetailsPayload payload;
-              try {
-                payload.up = FLAGS_output_uri_prefix + "/g";
-                for (const auto cit : yoda::Matrix<EventsByGID>::Accessor(data)[key]) {
-                  const auto eid_as_uint64 = static_cast<uint64_t>(cit.col);
-                  payload.event.push_back(SessionDetailsPayload::Event(
-                      eid_as_uint64, Printf("%s/e?eid=%llu", FLAGS_output_uri_prefix.c_str(), eid_as_uint64)));
+        const std::string version = DataVersion() + '-' + ToString(now_as_uint64 / 1000);
+        RespondCached(std::move(r), "/g?gid=" + key, version, [&db, &key, now_as_uint64]() {
+          SessionDetailsPayload payload;
+          db.Transaction([&payload, &key, now_as_uint64](typename DB::T_DATA data) {
+            const LatencyScope latency(Latency("transaction", "group_details"));
+            try {
+              payload.up = FLAGS_output_uri_prefix + "/g";
+              for (const auto cit : yoda::Matrix<EventsByGID>::Accessor(data)[key]) {
+                const auto eid_as_uint64 = static_cast<uint64_t>(cit.col);
+                payload.event.push_back(SessionDetailsPayload::Event(
+                    eid_as_uint64, Printf("%s/e?eid=%llu", FLAGS_output_uri_prefix.c_str(), eid_as_uint64)));
+              }
+              if (!payload.event.empty()) {
+                std::sort(std::begin(payload.event), std::end(payload.event));
+                for (auto& e : payload.event) {
+                  const auto ev = data[static_cast<EID>(e.eid_as_uint64)];
+                  e.time_ago = MillisecondIntervalAsString(now_as_uint64 - ev.ms);
+                  e.text = ev.Description();
                 }
-                if (!payload.event.empty()) {
-                  std::sort(std::begin(payload.event), std::end(payload.event));
-                  for (auto& e : payload.event) {
-                    const auto ev = data[static_cast<EID>(e.eid_as_uint64)];
-                    e.time_ago = MillisecondIntervalAsString(now_as_uint64 - ev.ms);
-                    e.text = ev.Description();
-                  }
-                  for (size_t i = 0; i + 1 < payload.event.size(); ++i) {
-                    payload.event[i].time_since_previous_event = MillisecondIntervalAsString(
-                        ((payload.event[i].eid_as_uint64 - payload.event[i + 1].eid_as_uint64) / 1000),
-                        "same second as the event below",
-                        "the event below + ");
-                  }
-                  payload.event.back().time_since_previous_event = "a long time ago in a galaxy far far away";
+                for (size_t i = 0; i + 1 < payload.event.size(); ++i) {
+                  payload.event[i].time_since_previous_event = MillisecondIntervalAsString(
+                      ((payload.event[i].eid_as_uint64 - payload.event[i + 1].eid_as_uint64) / 1000),
+                      "same second as the event below",
+                      "the event below + ");
                 }
-              } catch (const yoda::SubscriptException<EventsByGID>&) {
-                payload.error = "NOT FOUND";
+                payload.event.back().time_since_previous_event = "a long time ago in a galaxy far far away";
               }
-              return payload;
-            },
-            std::move(r));
+            } catch (const yoda::SubscriptException<EventsByGID>&) {
+              payload.error = "NOT FOUND";
+            }
+          }).Go();
+          return payload;
+        });
       }
     });
 
     // Sessions browser.
     // TODO(dkorolev): Browser, not just visualizer.
-    HTTP(FLAGS_port).Register(FLAGS_route + "s", [this, &db](Request r) {
-      db.Transaction([this, &db](typename DB::T_DATA data) {
-                       SessionsPayload payload;
-                       // Current sessions.
-                       current_sessions.ImmutableUse(
-                           [this, &payload](const CurrentSessions& current) { payload.current = current; });
-                       // Finalized sessions.
-                       const auto& accessor = yoda::Matrix<AggregatedSessionInfo>::Accessor(data);
-                       for (const auto& sessions_per_group : accessor.Cols()) {
-                         auto& results_per_group = payload.finalized[sessions_per_group.key().gid];
-                         for (const auto& individual_session : sessions_per_group) {
-                           results_per_group[individual_session.sid] = individual_session;
-                         }
-                       }
-                       return payload;
-                     },
-                     std::move(r));
+    RegisterTimed(HTTP(FLAGS_port), FLAGS_route + "s", [this, &db](Request r) {
+      // Not cached, as it is streamed, but not resent if the client has it already.
+      const std::string version = DataVersion();
+      if (RespondIfNotModified(r, version)) {
+        return;
+      }
+      SessionsQuery query(r.url.query);
+      auto response = r.connection.SendChunkedHTTPResponse(
+          HTTPResponseCode.OK, "application/json; charset=utf-8", HTTPHeaders({{"ETag", ETag(version)}}));
+      // Current sessions, on the first page only.
+      std::map<std::string, AggregatedSessionInfo> current;
+      db.Transaction([this, &query, &current](typename DB::T_DATA data) {
+        const LatencyScope latency(Latency("transaction", "current_sessions"));
+        FlushFinalizedSessions(data);
+        if (query.first_page) {
+          for (auto& shard : shards) {
+            shard->current_sessions.ImmutableUse([&query, &current](const CurrentSessions& sessions) {
+              for (const auto& cit : sessions.map) {
+                if (query.Matches(cit.second)) {
+                  current.insert(cit);
+                }
+              }
+            });
+          }
+        }
+      }).Go();
+      StreamingJSON json([&response](const std::string& chunk) { response.Send(chunk); });
+      json.BeginArray("current");
+      for (const auto& cit : current) {
+        StreamSession(json, cit.second, query.summary);
+      }
+      json.EndArray();
+      current.clear();
+      // Finalized sessions, chunk by chunk.
+      json.BeginArray("finalized");
+      size_t sent = 0;
+      bool done = false;
+      while (!done && sent < query.limit) {
+        SessionsChunk chunk;
+        const size_t max_sessions = std::min(static_cast<size_t>(kSessionsPerChunk), query.limit - sent);
+        db.Transaction([this, &query, &chunk, max_sessions](typename DB::T_DATA data) {
+          const LatencyScope latency(Latency("transaction", "sessions_chunk"));
+          chunk = NextSessionsChunk(data, query, max_sessions);
+        }).Go();
+        done = chunk.done;
+        for (const auto& session : chunk.sessions) {
+          StreamSession(json, session, query.summary);
+        }
+        sent += chunk.sessions.size();
+        json.Flush();
+      }
+      json.EndArray();
+      json.Field("next_cursor", done ? "" : query.cursor_gid + '/' + query.cursor_sid);
+      json.Finish();
     });
 
     // Export data for insight generation.
-    HTTP(FLAGS_port).Register(FLAGS_route + "i", [this, &db](Request r) {
-      db.Transaction([this](typename DB::T_DATA data) {
-                       const std::vector<int> second_marks({5, 10, 15, 30, 60, 120, 300});
-                       // Generate input data for insights.
-                       InsightsInput payload;
-                       // Create one and only realm so far.
-                       payload.realm.resize(payload.realm.size() + 1);
-                       InsightsInput::Realm& realm = payload.realm.front();
-                       // TODO(dkorolev): Bracketing, grouping, time windows.
-                       realm.description = "One and only realm.";
-                       // Explain time features.
-                       realm.tag["T"].name = "Session length";
-                       const auto& accessor = yoda::Matrix<AggregatedSessionInfo>::Accessor(data);
-                       for (const auto seconds : second_marks) {
-                         auto& feature = realm.feature[Printf(">=%ds", seconds)];
-                         feature.tag = "T";
-                         feature.yes = Printf("%d seconds or longer", seconds);
-                         feature.no = Printf("under %d seconds", seconds);
-                       }
-                       // Analyze individual sessions and export aggregated info about them.
-                       for (const auto& sessions_per_group : accessor.Cols()) {
-                         for (const auto& individual_session : sessions_per_group) {
-                           // Emit the information about this session, in a way that makes it
-                           // comparable with other sessions within the same realm.
-                           realm.session.resize(realm.session.size() + 1);
-                           InsightsInput::Session& output_session = realm.session.back();
-                           output_session.key = individual_session.sid;
-                           const int seconds = static_cast<int>(individual_session.number_of_seconds);
-                           for (const auto t : second_marks) {
-                             if (seconds >= t) {
-                               output_session.feature.emplace_back(Printf(">=%ds", t));
-                             }
-                           }
-                           for (const auto& counters : individual_session.counters) {
-                             const std::string& feature = counters.first;
-                             realm.tag[feature].name = feature;
-                             realm.feature[feature].tag = feature;
-                             realm.feature[feature].yes = "'" + feature + "'";
-                             output_session.feature.emplace_back(feature);
-                             for (size_t c = 2; c <= std::min(counters.second, static_cast<size_t>(10)); ++c) {
-                               const std::string count_feature =
-                                   Printf("%s>=%d", feature.c_str(), static_cast<int>(c));
-                               output_session.feature.emplace_back(count_feature);
-                               realm.feature[count_feature].tag = feature;
-                               realm.feature[count_feature].yes =
-                                   Printf("%d or more '%s'", static_cast<int>(c), feature.c_str());
-                               realm.feature[count_feature].no =
-                                   Printf("%d or less '%s'", static_cast<int>(c) - 1, feature.c_str());
-                             }
-                           }
-                         }
-                       }
-                       return payload;
-                     },
-                     std::move(r));
+    // Streamed, as `/s` is, in two passes: the descriptions of all the features first, then the sessions.
+    RegisterTimed(HTTP(FLAGS_port), FLAGS_route + "i", [this, &db](Request r) {
+      const std::string version = DataVersion();
+      if (RespondIfNotModified(r, version)) {
+        return;
+      }
+      // One and only realm so far, kept up to date as the sessions are finalized.
+      InsightsInput::Realm realm;
+      std::unique_ptr<FinalizationSequence::Export> finalized_before;
+      db.Transaction([this, &realm, &finalized_before](typename DB::T_DATA data) {
+        const LatencyScope latency(Latency("transaction", "insights_realm"));
+        FlushFinalizedSessions(data);
+        realm = insights_realm;
+        finalized_before.reset(new FinalizationSequence::Export(finalization_sequence));
+      }).Go();
+      auto response = r.connection.SendChunkedHTTPResponse(
+          HTTPResponseCode.OK, "application/json; charset=utf-8", HTTPHeaders({{"ETag", ETag(version)}}));
+      StreamingJSON json([&response](const std::string& chunk) { response.Send(chunk); });
+      json.BeginObject("value0");
+      json.BeginArray("realm");
+      json.BeginObject();
+      json.Field("description", realm.description);
+      json.Field("tag", realm.tag);
+      json.Field("feature", realm.feature);
+      // Analyze individual sessions and export aggregated info about them.
+      // Only the sessions described by the realm, finalized before it was copied, are exported.
+      json.BeginArray("session");
+      // Cut short should the export expire, as the cube export is.
+      if (!ForEachFinalizedSessionInChunks([&finalized_before, &json](const AggregatedSessionInfo& session) {
+            if (finalized_before->Includes(session)) {
+              InsightsInput::Session output_session;
+              ExportSessionForInsights(session, nullptr, &output_session);
+              json.Element(output_session);
+            }
+            return !finalized_before->Expired();
+          })) {
+        std::cerr << "The insights export has expired, with too many sessions finalized while it was open.\n";
+        return;
+      }
+      json.EndArray();
+      json.EndObject();
+      json.EndArray();
+      json.EndObject();
+      json.Finish();
     });
 
     // Export data for cubes generation.
-    HTTP(FLAGS_port).Register(FLAGS_route + "c", [this, &db](Request r) {
-      db.Transaction(
-          [this](typename DB::T_DATA data) {
-            CubeGeneratorInput payload;
-            auto& dimensions = payload.space.dimensions;
-            auto& sessions = payload.sessions;
-
-            // map<FEATURE, map<FEATURE_COUNT_IN_SESSION, NUMBER_OF_SESSION_CONTAINING_THIS_COUNT>>
-            std::map<std::string, std::map<size_t, size_t>> feature_stats;
-
-            // Populate all the sessions.
-            const auto& accessor = yoda::Matrix<AggregatedSessionInfo>::Accessor(data);
-            for (const auto& sessions_per_group : accessor.Cols()) {
-              for (const auto& individual_session : sessions_per_group) {
-                sessions.resize(sessions.size() + 1);
-                CubeGeneratorInput::Session& output_session = sessions.back();
-                output_session.id = individual_session.sid;
-                // Dedicated handling for the "number of seconds" dimension.
-                output_session.feature_count[TIME_DIMENSION_NAME] = individual_session.number_of_seconds;
-                ++feature_stats[TIME_DIMENSION_NAME][individual_session.number_of_seconds];
-                // Generic handling for all tracked dimensions.
-                for (const auto& feature_counter : individual_session.counters) {
-                  const std::string& feature = feature_counter.first;
-                  output_session.feature_count[feature] = feature_counter.second;
-                  ++feature_stats[feature][feature_counter.second];
-                }
-              }
-            }
-
-            // Put `Session Length` and `Device` dimensions first.
-            const std::vector<size_t> second_marks({5, 10, 15, 30, 60, 120, 300});
-            dimensions.emplace_back(TIME_DIMENSION_NAME);
-            Dimension& time_dimension = dimensions.back();
-            assert(second_marks.size() > 1u);
-            for (size_t i = 0; i < second_marks.size() - 1u; ++i) {
-              const size_t a = second_marks[i];
-              const size_t b = (i != second_marks.size() - 2u) ? second_marks[i + 1] - 1u : second_marks[i + 1];
-              if (i == 0) {
-                Bin first_bin("< " + std::to_string(a), a, Bin::RangeType::LESS);
-                time_dimension.bins.push_back(first_bin);
-              }
-              Bin bin_range(std::to_string(a) + " - " + std::to_string(b), a, b, Bin::RangeType::INTERVAL);
-              time_dimension.bins.push_back(bin_range);
-              if (i == second_marks.size() - 2u) {
-                Bin last_bin("> " + std::to_string(b), b, Bin::RangeType::GREATER);
-                time_dimension.bins.push_back(last_bin);
-              }
-            }
-            dimensions.emplace_back(DEVICE_DIMENSION_NAME);
-            dimensions.back().bins.emplace_back(DEVICE_UNSPECIFIED_BIN_NAME);
-
-            // Fill dimensions info in the response.
-            for (const auto& cit : feature_stats) {
-              const std::string feature = cit.first;
+    // Streamed, the space first, then the sessions finalized before it was populated, which it has the bins of.
+    // With `since=<cursor>`, only the sessions finalized past the cursor, along with the next cursor.
+    // The cursors that can not be followed get all the sessions, streamed the same way, and marked as `full`.
+    RegisterTimed(HTTP(FLAGS_port), FLAGS_route + "c", [this, &db](Request r) {
+      const std::string version = DataVersion();
+      if (RespondIfNotModified(r, version)) {
+        return;
+      }
+      const std::string since = r.url.query["since"];
+      if (since.empty()) {
+        StreamCube(std::move(r), version, false);
+        return;
+      }
+      bool recent = false;
+      db.Transaction([this, &since, &recent](typename DB::T_DATA) {
+        recent = cube_stats.IsRecentCursor(since);
+      }).Go();
+      if (recent) {
+        // Should the cursor expire in between, which it then stays, the response is empty, and not sent.
+        const std::string key = "/c?since=" + since;
+        const ResponseCache::RESPONSE response = response_cache.Get(key, version, [this, &db, &since]() {
+          CubeDelta payload;
+          bool followed = false;
+          db.Transaction([this, &payload, &since, &followed](typename DB::T_DATA data) {
+            const LatencyScope latency(Latency("transaction", "cube_delta"));
+            FlushFinalizedSessions(data);
+            payload.cursor = cube_stats.Cursor();
+            cube_stats.PopulateSpace(payload.cube.space);
+            auto& sessions = payload.cube.sessions;
+            const auto add = [&sessions](CubeGeneratorInput::Session&& session) {
+              sessions.push_back(std::move(session));
+            };
+            followed = cube_stats.ForEachSessionSince(since, add);
+          }).Go();
+          return followed ? JSON(payload) + '\n' : std::string();
+        });
+        if (!response->empty()) {
+          r(*response,
+            HTTPResponseCode.OK,
+            "application/json; charset=utf-8",
+            HTTPHeaders({{"ETag", ETag(version)}}));
+          return;
+        }
+      }
+      StreamCube(std::move(r), version, true);
+    });
+  }
 
-              const auto dim_bin = payload.space.SplitFeatureIntoDimensionAndBinNames(feature);
-              if (dim_bin.first.empty()) {
-                // Skip filtered out features.
-                continue;
-              }
+  // Streams the cube of all the finalized sessions, as `CubeGeneratorInput`, or, if `as_delta`, as the full
+  // `CubeDelta`, with the cursor as of the space. Not cached, for it is never held in memory as a whole.
+  void StreamCube(Request r, const std::string& version, bool as_delta) {
+    Space space;
+    std::string cursor;
+    std::unique_ptr<FinalizationSequence::Export> finalized_before;
+    db.Transaction([this, &space, &cursor, &finalized_before](typename DB::T_DATA data) {
+      const LatencyScope latency(Latency("transaction", "cube_space"));
+      FlushFinalizedSessions(data);
+      cursor = cube_stats.Cursor();
+      cube_stats.PopulateSpace(space);
+      finalized_before.reset(new FinalizationSequence::Export(finalization_sequence));
+    }).Go();
+    auto response = r.connection.SendChunkedHTTPResponse(
+        HTTPResponseCode.OK, "application/json; charset=utf-8", HTTPHeaders({{"ETag", ETag(version)}}));
+    StreamingJSON json([&response](const std::string& chunk) { response.Send(chunk); });
+    json.BeginObject("value0");
+    if (as_delta) {
+      json.Field("cursor", cursor);
+      json.Field("full", true);
+      json.BeginObject("cube");
+    }
+    json.Field("space", space);
+    json.BeginArray("sessions");
+    // Should the export expire, the response is cut short, for the client to see it has failed.
+    if (!ForEachFinalizedSessionInChunks([&finalized_before, &json](const AggregatedSessionInfo& session) {
+          if (finalized_before->Includes(session)) {
+            json.Element(CubeStats::ExportSession(session.sid, session.number_of_seconds, session.counters));
+          }
+          return !finalized_before->Expired();
+        })) {
+      std::cerr << "The cube export has expired, with too many sessions finalized while it was open.\n";
+      return;
+    }
+    json.EndArray();
+    if (as_delta) {
+      json.EndObject();
+    }
+    json.EndObject();
+    json.Finish();
+  }
 
-              Dimension* dim_in_space = payload.space.DimensionByName(dim_bin.first);
-              if (dim_bin.second.empty()) {
-                assert(!dim_in_space);
-                Dimension dim(dim_bin.first);
-                dim.bins.emplace_back(NONE_BIN_NAME);
-                dim.SmartCreateBins(cit.second);
-                dimensions.push_back(dim);
-              } else {
-                if (!dim_in_space) {
-                  Dimension dim(dim_bin.first);
-                  dimensions.push_back(dim);
-                  dim_in_space = &dimensions.back();
-                }
-                Bin bin(dim_bin.second, feature);
-                dim_in_space->AddBinIfNotExists(bin);
-              }
-            }
+  // The group of the event, or an empty string for the events that are not grouped.
+  static std::string GroupID(const MidichloriansEvent& e) {
+    return e.device_id.empty() ? "" : "CID:" + e.device_id;
+  }
 
-            return payload;
-          },
-          std::move(r));
-    });
+  // Landing pages for searches are the grouped events URI and the individual event URI.
+  static std::vector<std::string> SearchLandingPages(const std::string& gid, uint64_t eid) {
+    return {"/g?gid=" + gid, Printf("/e?eid=%llu", eid)};
   }
 
   void RealEvent(EID eid, const MidichloriansEventWithTimestamp& event, typename DB::T_DATA& data) {
     PROFILER_SCOPE("Splitter::RealEvent()");
+    static LatencyMetric& real_event_latency = Latency("ingestion", "real_event");
+    const LatencyScope latency(real_event_latency);
 
     // Only real events, not ticks with empty `event.e`, should make it here.
     const auto& e = event.e;
     assert(e);
 
+    FlushFinalizedSessions(data);
+
     // Start / update / end active sessions.
-    const std::string& cid = e->device_id;
-    if (!cid.empty()) {
+    const std::string gid = GroupID(*e);
+    if (!gid.empty()) {
       // Keep track of events per group.
-      const std::string gid = "CID:" + cid;
       {
         PROFILER_SCOPE("`data.Add()`.");
         data.Add(EventsByGID(gid, static_cast<uint64_t>(eid)));
       }
 
-      // Keep track of current and finalized sessions.
-      // TODO(dkorolev): This should be a listener to support a chain of streams, not a WaitableAtomic<>.
+      // Keep track of current and finalized sessions, on the shard of this group.
       {
-        PROFILER_SCOPE("`current_sessions.MutableUse()`.");
-        current_sessions.MutableUse([this, eid, &gid, &e, &event, &data](CurrentSessions& current) {
-          const uint64_t ms = event.ms;
-          current.EndTimedOutSessions(ms, data);
-          auto& s = current.map[gid];
-          if (s.gid.empty()) {
-            // A new session is to be created.
-            static int index = 100000;
-            s.sid = Printf("K%d", ++index);
-            s.gid = gid;
-            s.ms_first = ms;
-          }
-          s.ms_last = ms;
-          const std::string counter_name = event.CanonicalDescription();
-          if (!counter_name.empty()) {
-            ++s.counters[counter_name];
+        PROFILER_SCOPE("Push to the session shard.");
+        SessionShard::Step step;
+        step.ms = event.ms;
+        step.is_tick = false;
+        step.eid = eid;
+        step.feature_id = Singleton<FeatureDictionary>().FeatureID(event);
+        step.gid = gid;
+        const size_t shard = ShardIndex(gid);
+        for (size_t i = 0; i < shards.size(); ++i) {
+          auto& window = shard_windows[i];
+          if (i == shard) {
+            step.window_min_ms = window.first;
+            step.window_max_ms = window.second;
+            window = std::make_pair(std::numeric_limits<uint64_t>::max(), 0ull);
+          } else {
+            window.first = std::min(window.first, event.ms);
+            window.second = std::max(window.second, event.ms);
           }
-          s.events.push_back(static_cast<uint64_t>(eid));
-        });
+        }
+        shards[shard]->Push(std::move(step));
       }
 
       // Keep events searchable.
       {
-        PROFILER_SCOPE("`Singleton<WaitableAtomic<SearchIndex>>().MutableUse()`.");
-        Singleton<WaitableAtomic<SearchIndex>>().MutableUse([this, eid, &gid, &e, &event](SearchIndex& index) {
-          // Landing pages for searched are grouped event URI and individual event URI.
-          std::vector<std::string> values = {"/g?gid=" + gid,
-                                             Printf("/e?eid=%llu", static_cast<uint64_t>(eid))};
-          for (const auto& rhs : values) {
-            // Populate each term.
-            RTTIDynamicCall<typename SearchIndex::Populator::T_TYPES>(*e.get(),  // Yes, `const unique_ptr<>`.
-                                                                      SearchIndex::Populator(index, rhs));
-            index.AddToIndex(gid, rhs);
-            index.AddToIndex(ToString(event.ms), rhs);
-            // Make keys and parts of keys themselves searchable.
-            for (const auto& lhs : values) {
-              index.AddToIndex(lhs, rhs);
-            }
+        PROFILER_SCOPE("`Singleton<SearchIndex>().Add()`.");
+        SearchIndex::Batch batch;
+        const std::vector<std::string> values = SearchLandingPages(gid, static_cast<uint64_t>(eid));
+        for (const auto& rhs : values) {
+          // Populate each term.
+          event.DispatchEvent(SearchIndex::Populator(batch, rhs));
+          batch.AddToIndex(gid, rhs);
+          batch.AddToIndex(ToString(event.ms), rhs);
+          // Make keys and parts of keys themselves searchable.
+          for (const auto& lhs : values) {
+            batch.AddToIndex(lhs, rhs);
           }
-        });
+        }
+        Singleton<SearchIndex>().Add(std::move(batch));
       }
     }
   }
 
   void TickEvent(uint64_t ms, typename DB::T_DATA& data) {
-    // End active sessions.
-    current_sessions.MutableUse(
-        [this, ms, &data](CurrentSessions& current) { current.EndTimedOutSessions(ms, data); });
+    static LatencyMetric& tick_event_latency = Latency("ingestion", "tick_event");
+    const LatencyScope latency(tick_event_latency);
+    FlushFinalizedSessions(data);
+    // Make the events so far searchable.
+    Singleton<SearchIndex>().Publish();
+    // End active sessions, on each shard.
+    for (size_t i = 0; i < shards.size(); ++i) {
+      SessionShard::Step step;
+      step.ms = ms;
+      step.window_min_ms = shard_windows[i].first;
+      step.window_max_ms = shard_windows[i].second;
+      shard_windows[i] = std::make_pair(std::numeric_limits<uint64_t>::max(), 0ull);
+      shards[i]->Push(std::move(step));
+    }
   }
 };
 
+// Periodic checkpoints, for restarts not to replay the whole input.
+// The checkpoint is the state as of some offset in the input, in two files in the checkpoint directory.
+// What only grows, the events, the finalized sessions, and the documents of the search index, is appended to
+// `log.bin`, each checkpoint appending what is new since the previous one. The rest, the open sessions and the
+// postings of the search index, is in `state.bin`, along with the offset and the size of the log as of it.
+// On restart the state is loaded from them as is, and the input is read on from that offset.
+//
+// To be consistent with the input offset, the checkpoint is taken right before the first entry of some batch:
+// once a checkpoint is due, the listener asks the ingestion loop to report where its next batch ends, and
+// waits for the entry that follows. Within its transaction, the listener only hands over what the checkpoint
+// consists of to a dedicated thread: the EID-s of the new events, the new sessions, a copy of the open ones,
+// and the segments of the search index, which are immutable. That thread reads the events back by short
+// transactions, and serializes everything into the files, so that the listener never waits for either.
+struct Checkpoints {
+  struct Header {
+    uint64_t input_offset = 0;
+    uint64_t last_key = 0;
+    uint64_t log_size = 0;   // How much of the log the checkpoint covers.
+    uint32_t documents = 0;  // How many documents of the search index the log has.
+    template <typename A>
+    void serialize(A& ar) {
+      ar(CEREAL_NVP(input_offset), CEREAL_NVP(last_key), CEREAL_NVP(log_size), CEREAL_NVP(documents));
+    }
+  };
+
+  // The kinds of the records of the log.
+  enum class Record : uint64_t { Events = 1, Sessions = 2, Documents = 3 };
+  enum { kEventsPerRecord = 10000, kSessionsPerRecord = 1000, kDocumentsPerRecord = 10000 };
+
+  Checkpoints(DB& db, const std::string& dir, uint64_t interval_ms)
+      : db(db),
+        snapshot_file_name(dir + "/state.bin"),
+        log_file_name(dir + "/log.bin"),
+        interval_ms(interval_ms),
+        next_checkpoint_ms(static_cast<uint64_t>(Now()) + interval_ms),
+        writer_thread(&Checkpoints::WriterThread, this) {}
+
+  // Writes the checkpoints taken, if they have not been written yet.
+  ~Checkpoints() {
+    {
+      std::lock_guard<std::mutex> lock(writer_mutex);
+      destructing = true;
+    }
+    writer_condition_variable.notify_all();
+    writer_thread.join();
+  }
+
+  // Step one, before the input is opened: read the header of the snapshot, if there is one.
+  // Returns false if there is no snapshot. Throws on errors.
+  bool Load() {
+    if (!FileExists(snapshot_file_name)) {
+      return false;
+    }
+    snapshot.reset(new CheckpointReader(snapshot_file_name));
+    snapshot->Read(header);
+    return true;
+  }
+
+  // Step two, before `raw` is listened to: restore the state, and start appending to the log past it.
+  void Restore(Splitter& splitter) {
+    if (snapshot) {
+      db.Transaction([this, &splitter](typename DB::T_DATA data) {
+        const LatencyScope latency(Latency("transaction", "checkpoint_restore"));
+        const auto restore = [&data, &splitter](CheckpointRecordReader& r) {
+          uint64_t kind;
+          size_t size;
+          r.Read(kind);
+          r.Read(size);
+          if (kind == static_cast<uint64_t>(Record::Events)) {
+            uint64_t eid = 0;
+            for (size_t i = 0; i < size; ++i) {
+              uint64_t eid_delta;
+              uint64_t ms_lag;
+              r.Read(eid_delta);
+              r.Read(ms_lag);
+              eid += eid_delta;
+              MidichloriansEventWithTimestamp entry(
+                  eid / 1000 - ms_lag, r.ReadPolymorphic<MIDICHLORIAN_EVENT_TYPES, MidichloriansEvent>());
+              entry.key = static_cast<EID>(eid);
+              const std::string gid = Splitter::GroupID(*entry.e);
+              data.Add(entry);
+              if (!gid.empty()) {
+                data.Add(EventsByGID(gid, eid));
+              }
+            }
+          } else if (kind == static_cast<uint64_t>(Record::Sessions)) {
+            for (size_t i = 0; i < size; ++i) {
+              AggregatedSessionInfo session;
+              r.Read(session);
+              splitter.AddFinalizedSession(data, session);
+            }
+          } else if (kind == static_cast<uint64_t>(Record::Documents)) {
+            for (size_t i = 0; i < size; ++i) {
+              std::string uri;
+              r.Read(uri);
+              Singleton<SearchIndex>().RestoreDocument(uri);
+            }
+          } else {
+            throw CompactArchiveException();
+          }
+        };
+        ForEachCheckpointLogRecord(log_file_name, header.log_size, restore);
+      }).Go();
+      std::map<std::string, AggregatedSessionInfo> current_sessions;
+      snapshot->Read(current_sessions);
+      std::vector<int> last_session_indexes;
+      snapshot->Read(last_session_indexes);
+      splitter.RestoreCurrentSessions(std::move(current_sessions), last_session_indexes);
+      Singleton<SearchIndex>().RestorePostings(*snapshot);
+      snapshot->Done();
+      ++splitter.data_changes;
+      std::cerr << "Restored from the checkpoint at input offset " << header.input_offset << ".\n";
+      snapshot.reset();
+    }
+    written = header;
+  }
+
+  // Called by the ingestion loop after each batch.
+  void BatchPublished(size_t published_entries, uint64_t input_offset, uint64_t last_key) {
+    if (boundary_requested && !boundary_ready) {
+      std::lock_guard<std::mutex> lock(boundary_mutex);
+      boundary.published_entries = published_entries;
+      boundary.input_offset = input_offset;
+      boundary.last_key = last_key;
+      boundary_ready = true;
+    }
+  }
+
+  // Called by the listener before the entry with the given index of `raw` is processed.
+  void BeforeEntry(size_t index, typename DB::T_DATA& data, Splitter& splitter) {
+    if (!boundary_requested) {
+      if (static_cast<uint64_t>(Now()) >= next_checkpoint_ms) {
+        boundary_requested = true;
+      }
+      return;
+    }
+    if (boundary_ready) {
+      Boundary b;
+      {
+        std::lock_guard<std::mutex> lock(boundary_mutex);
+        b = boundary;
+      }
+      if (b.published_entries <= index) {
+        if (b.published_entries == index) {
+          Take(b, data, splitter);
+          boundary_requested = false;
+        }
+        boundary_ready = false;
+      }
+    }
+  }
+
+  // Called by the listener for each event it processes, and by the splitter for each session it finalizes,
+  // for them to make it into the next checkpoint.
+  void EventProcessed(EID eid) { new_eids.push_back(static_cast<uint64_t>(eid)); }
+  void SessionFinalized(const AggregatedSessionInfo& session) { new_sessions.push_back(session); }
+
+  DB& db;
+  const std::string snapshot_file_name;
+  const std::string log_file_name;
+  const uint64_t interval_ms;
+  Header header;
+
+ private:
+  struct Boundary {
+    size_t published_entries = 0;
+    uint64_t input_offset = 0;
+    uint64_t last_key = 0;
+  };
+
+  // A checkpoint taken by the listener, for the writer thread to write.
+  struct Taken {
+    Header header;
+    uint64_t begin_ms;
+    std::vector<uint64_t> eids;
+    std::vector<AggregatedSessionInfo> sessions;
+    std::map<std::string, AggregatedSessionInfo> current_sessions;
+    std::vector<int> last_session_indexes;
+    SearchIndex::Snapshot search;
+  };
+
+  void Take(const Boundary& b, typename DB::T_DATA& data, Splitter& splitter) {
+    std::unique_ptr<Taken> taken(new Taken());
+    taken->header.input_offset = b.input_offset;
+    taken->header.last_key = b.last_key;
+    taken->begin_ms = static_cast<uint64_t>(Now());
+    splitter.DrainSessions(data);
+    taken->eids.swap(new_eids);
+    taken->sessions.swap(new_sessions);
+    taken->current_sessions = splitter.MergedCurrentSessions().map;
+    taken->last_session_indexes = splitter.LastSessionIndexes();
+    taken->search = Singleton<SearchIndex>().TakeSnapshot();
+    taken->header.documents = taken->search.documents;
+    {
+      std::lock_guard<std::mutex> lock(writer_mutex);
+      queue.push_back(std::move(taken));
+    }
+    writer_condition_variable.notify_all();
+    next_checkpoint_ms = static_cast<uint64_t>(Now()) + interval_ms;
+  }
+
+  // Appends the new events, sessions, and documents to the log, the documents past the first `documents`.
+  void AppendToLog(const Taken& taken, uint32_t& documents) {
+    for (size_t begin = 0; begin < taken.eids.size(); begin += kEventsPerRecord) {
+      const size_t end = std::min(begin + static_cast<size_t>(kEventsPerRecord), taken.eids.size());
+      CheckpointRecordWriter record;
+      record.Write(static_cast<uint64_t>(Record::Events));
+      record.Write(end - begin);
+      // The EID-s are written as deltas, and the timestamps as how far they lag behind the EID-s, which is
+      // rarely at all, see `NextEntryKey()`.
+      db.Transaction([&taken, &record, begin, end](typename DB::T_DATA data) {
+        const LatencyScope latency(Latency("transaction", "checkpoint_events"));
+        const auto events = yoda::Dictionary<MidichloriansEventWithTimestamp>::Accessor(data);
+        uint64_t previous_eid = 0;
+        for (size_t i = begin; i < end; ++i) {
+          const uint64_t eid = taken.eids[i];
+          const MidichloriansEventWithTimestamp& entry = events.Get(static_cast<EID>(eid));
+          record.Write(eid - previous_eid);
+          record.Write(eid / 1000 - entry.ms);
+          record.WritePolymorphic<MIDICHLORIAN_EVENT_TYPES>(*entry.e);
+          previous_eid = eid;
+        }
+      }).Go();
+      log->Append(record.Data());
+    }
+    for (size_t begin = 0; begin < taken.sessions.size(); begin += kSessionsPerRecord) {
+      const size_t end = std::min(begin + static_cast<size_t>(kSessionsPerRecord), taken.sessions.size());
+      CheckpointRecordWriter record;
+      record.Write(static_cast<uint64_t>(Record::Sessions));
+      record.Write(end - begin);
+      for (size_t i = begin; i < end; ++i) {
+        record.Write(taken.sessions[i]);
+      }
+      log->Append(record.Data());
+    }
+    for (uint32_t begin = documents; begin < taken.search.documents; begin += kDocumentsPerRecord) {
+      const uint32_t end = std::min(begin + static_cast<uint32_t>(kDocumentsPerRecord), taken.search.documents);
+      CheckpointRecordWriter record;
+      record.Write(static_cast<uint64_t>(Record::Documents));
+      record.Write(static_cast<size_t>(end - begin));
+      for (uint32_t id = begin; id < end; ++id) {
+        record.Write(Singleton<SearchIndex>().URI(id));
+      }
+      log->Append(record.Data());
+    }
+    documents = taken.search.documents;
+  }
+
+  // Writes the checkpoints taken, in order. The log gets what is new in each, and the snapshot is that of the
+  // last one. Throws `std::runtime_error`, having dropped what was appended to the log past the last snapshot.
+  void Write(const std::deque<std::unique_ptr<Taken>>& unwritten) {
+    try {
+      if (!log) {
+        log.reset(new CheckpointLogWriter(log_file_name, written.log_size));
+      }
+      uint32_t documents = written.documents;
+      for (const auto& taken : unwritten) {
+        AppendToLog(*taken, documents);
+      }
+      log->Flush();
+      const Taken& last = *unwritten.back();
+      Header h = last.header;
+      h.log_size = log->Size();
+      CheckpointWriter writer(snapshot_file_name);
+      writer.Write(h);
+      writer.Write(last.current_sessions);
+      writer.Write(last.last_session_indexes);
+      SearchIndex::WritePostings(last.search, writer);
+      writer.Commit();
+      written = h;
+      std::cerr << "Checkpoint at input offset " << h.input_offset << ", " << writer.Size() << " bytes, and "
+                << h.log_size << " bytes of the log, took " << (static_cast<uint64_t>(Now()) - last.begin_ms)
+                << " ms.\n";
+    } catch (...) {
+      // Reopened, and cut at the last snapshot, by the next attempt.
+      log.reset();
+      throw;
+    }
+  }
+
+  void WriterThread() {
+    // Should writing fail, what was taken is kept, and written along with the next checkpoint.
+    std::deque<std::unique_ptr<Taken>> unwritten;
+    while (true) {
+      {
+        std::unique_lock<std::mutex> lock(writer_mutex);
+        writer_condition_variable.wait(lock, [this] { return !queue.empty() || destructing; });
+        if (queue.empty()) {
+          return;
+        }
+        while (!queue.empty()) {
+          unwritten.push_back(std::move(queue.front()));
+          queue.pop_front();
+        }
+      }
+      try {
+        Write(unwritten);
+        unwritten.clear();
+      } catch (const std::exception& e) {
+        std::cerr << "Checkpoint failed: " << e.what() << "\n";
+      }
+    }
+  }
+
+  std::unique_ptr<CheckpointReader> snapshot;
+
+  // Listener thread only.
+  uint64_t next_checkpoint_ms;
+  std::vector<uint64_t> new_eids;
+  std::vector<AggregatedSessionInfo> new_sessions;
+
+  std::atomic_bool boundary_requested{false};
+  std::atomic_bool boundary_ready{false};
+  std::mutex boundary_mutex;
+  Boundary boundary;
+
+  // Writer thread only, once restored.
+  std::unique_ptr<CheckpointLogWriter> log;
+  Header written;  // As of the last snapshot written.
+
+  std::mutex writer_mutex;
+  std::condition_variable writer_condition_variable;
+  std::deque<std::unique_ptr<Taken>> queue;
+  bool destructing = false;
+  std::thread writer_thread;
+};
+
 // Event listening logic.
 struct Listener {
   DB& db;
   Splitter splitter;
-  std::atomic_size_t total_processed_entries;
+  ProcessedEntries total_processed_entries;
+  Checkpoints* checkpoints = nullptr;
 
-  explicit Listener(DB& db) : db(db), splitter(db), total_processed_entries(0) {}
+  explicit Listener(DB& db) : db(db), splitter(db) {}
 
   inline bool operator()(const EID eid, size_t index) {
     PROFILER_SCOPE("Listener::operator()");
@@ -566,11 +1560,20 @@ struct Listener {
     db.Transaction([this, eid, index](typename DB::T_DATA data) {
       // Yep, it's an extra, synchronous, lookup. But this solution is cleaner data-wise.
       PROFILER_SCOPE("`db.Transaction()`");
+      // The listener's share of the ingestion is this transaction, as the call itself only schedules it.
+      static LatencyMetric& listener_latency = Latency("ingestion", "listener");
+      const LatencyScope latency(listener_latency);
+      if (checkpoints) {
+        checkpoints->BeforeEntry(index, data, splitter);
+      }
       const auto entry = yoda::Dictionary<MidichloriansEventWithTimestamp>::Accessor(data).Get(eid);
       if (entry) {
         // Found in the DB: we have a log-entry-based event.
         PROFILER_SCOPE("Call `RealEvent()`");
         splitter.RealEvent(eid, static_cast<const MidichloriansEventWithTimestamp&>(entry), data);
+        if (checkpoints) {
+          checkpoints->EventProcessed(eid);
+        }
       } else {
         PROFILER_SCOPE("Call `TickEvent()`");
         // Not found in the DB: we have a tick event.
@@ -581,7 +1584,8 @@ struct Listener {
         assert(tmp % 1000 == 999);
         splitter.TickEvent(static_cast<uint64_t>(eid) / 1000, std::ref(data));
       }
-      total_processed_entries = index + 1;
+      total_processed_entries.Set(index + 1);
+      ++splitter.data_changes;
     });
     // TODO(dkorolev): Add extra logic to ensure this is safe.
     // Caveat: `Listener` gets deleted before its transactions are complete.
@@ -606,48 +1610,42 @@ struct TopLevelResponse {
     }
   };
   std::vector<std::string> search_results;
+  size_t search_results_count_estimate = 0;
+  std::string search_results_next_cursor;  // The `cursor` for the next page of search results, if there is one.
   std::vector<Route> route = {{"/?q=<SEARCH_QUERY>", "This view, optionally with search results."},
+                              {"/?q=<SEARCH_QUERY>&limit=<N>&cursor=<C>", "A page of search results."},
                               {"/s", "Sessions browser (top-level)."},  // TODO(dkorolev): REST-ful interface.
                               {"/g?gid=<GID>", "Grouped events browser (mid-level)."},
                               {"/e?eid=<EID>", "Events details browser (low-level)."},
                               {"/log", "Raw events log, persisent connection."},
                               {"/stats", "Total counters."}};
-  void Prepare(const std::string& query) {
+  void Prepare(const std::string& query, const std::string& limit_string, const std::string& cursor_string) {
     for (auto& route_entry : route) {
       route_entry.uri = FLAGS_output_uri_prefix + route_entry.uri;
     }
     if (!query.empty()) {
-      Singleton<WaitableAtomic<SearchIndex>>().ImmutableUse([this, &query](const SearchIndex& index) {
-        std::set<std::string> current;
-        for (const auto& term : Split(ToLower(query), ::isalnum)) {
-          const auto cit = index.terms.find(term);
-          if (cit != index.terms.end()) {
-            const std::set<std::string>& matches = cit->second;
-            if (current.empty()) {
-              current = matches;
-            } else {
-              std::set<std::string> intersected;
-              std::set_intersection(current.begin(),
-                                    current.end(),
-                                    matches.begin(),
-                                    matches.end(),
-                                    std::inserter(intersected, intersected.begin()));
-              if (!intersected.empty()) {
-                current.swap(intersected);
-              }
-            }
-          }
-        }
-        search_results.assign(current.rbegin(), current.rend());
-        for (auto& uri : search_results) {
-          uri = FLAGS_output_uri_prefix + uri;
-        }
-      });
+      const size_t limit = std::min(
+          static_cast<size_t>(limit_string.empty() ? FLAGS_search_limit : FromString<uint64_t>(limit_string)),
+          static_cast<size_t>(FLAGS_search_max_limit));
+      const uint32_t cursor =
+          cursor_string.empty() ? SearchIndex::kFirstPage : FromString<uint32_t>(cursor_string);
+      SearchIndex::Results results = Singleton<SearchIndex>().Search(query, limit, cursor);
+      search_results.swap(results.uris);
+      for (auto& uri : search_results) {
+        uri = FLAGS_output_uri_prefix + uri;
+      }
+      search_results_count_estimate = results.count_estimate;
+      if (results.next_cursor) {
+        search_results_next_cursor = ToString(results.next_cursor);
+      }
     }
   }
   template <typename A>
   void serialize(A& ar) {
-    ar(CEREAL_NVP(search_results), CEREAL_NVP(route));
+    ar(CEREAL_NVP(search_results),
+       CEREAL_NVP(search_results_count_estimate),
+       CEREAL_NVP(search_results_next_cursor),
+       CEREAL_NVP(route));
   }
 };
 
@@ -659,13 +1657,81 @@ int main(int argc, char** argv) {
     return -1;
   }
 
+  // Read from standard input, plain or gzipped, from the memory-mapped or gzipped file,
+  // or from the binary event log.
+  IngestionParams ingestion;
+  ingestion.parse_threads = static_cast<size_t>(std::max(FLAGS_parse_threads, 1));
+  ingestion.tick_interval_ms = FLAGS_tick_interval_ms;
+  ingestion.max_backlog = static_cast<size_t>(FLAGS_max_backlog);
+  if (FLAGS_backlog_policy == "block") {
+    ingestion.backlog_policy = BacklogPolicy::BLOCK;
+  } else if (FLAGS_backlog_policy == "shed") {
+    ingestion.backlog_policy = BacklogPolicy::SHED;
+  } else {
+    std::cerr << "`--backlog_policy` should be \"block\" or \"shed\"." << std::endl;
+    return -1;
+  }
+
+  // "db" is a structured Yoda storage of processed events, sessions, and so on.
+  // "db" is exposed via HTTP.
+  // Created ahead of the checkpoints, for it to outlive them, as they read the events from it.
+  DB db("db");
+
+  // Resume from the last checkpoint, if there is one, see `Checkpoints`.
+  std::unique_ptr<Checkpoints> checkpoints;
+  uint64_t resume_offset = 0;
+  if (!FLAGS_checkpoint_dir.empty()) {
+    if (!FLAGS_binary_input.empty() || FLAGS_from_offset) {
+      std::cerr << "`--checkpoint_dir` does not work with `--binary_input` or `--from_offset`." << std::endl;
+      return -1;
+    }
+    checkpoints.reset(new Checkpoints(db, FLAGS_checkpoint_dir, FLAGS_checkpoint_interval_ms));
+    try {
+      if (checkpoints->Load()) {
+        resume_offset = checkpoints->header.input_offset;
+        ingestion.initial_last_key = checkpoints->header.last_key;
+      }
+    } catch (const std::exception& e) {
+      std::cerr << "Can not load the checkpoint from `" << checkpoints->snapshot_file_name << "`: " << e.what()
+                << std::endl;
+      return -1;
+    }
+  }
+
+  try {
+    if (!FLAGS_binary_input.empty()) {
+      // Opened here, to fail early if it can not be, and handed over to the replay.
+      ingestion.binary_input.reset(
+          new BinaryEventLogReader<MidichloriansEvent, MIDICHLORIAN_EVENT_TYPES>(FLAGS_binary_input));
+    } else if (IsGzipFileName(FLAGS_input)) {
+      if (FLAGS_from_offset || FLAGS_to_offset) {
+        std::cerr << "`--from_offset` and `--to_offset` are not supported for gzipped input." << std::endl;
+        return -1;
+      }
+      std::unique_ptr<GzipLineSource> source(new GzipLineSource(GzipLineSource::OpenFile(FLAGS_input), true));
+      source->SkipBytes(resume_offset);
+      ingestion.source = std::move(source);
+    } else if (!FLAGS_input.empty()) {
+      ingestion.source.reset(new MemoryMappedLineSource(
+          FLAGS_input, resume_offset ? resume_offset : FLAGS_from_offset, FLAGS_to_offset));
+    } else {
+      std::unique_ptr<GzipLineSource> source(new GzipLineSource());
+      source->SkipBytes(resume_offset);
+      ingestion.source = std::move(source);
+    }
+  } catch (const std::runtime_error& e) {
+    std::cerr << e.what() << std::endl;
+    return -1;
+  }
+
 #ifdef PROFILER_ENABLED
   PROFILER_HTTP_ROUTE(FLAGS_port, FLAGS_profiler_route);
 #endif
+  METRICS_HTTP_ROUTE(FLAGS_port, FLAGS_metrics_route);
 
-  HTTP(FLAGS_port).Register(FLAGS_route, [](Request r) {
+  RegisterTimed(HTTP(FLAGS_port), FLAGS_route, [](Request r) {
     TopLevelResponse e;
-    e.Prepare(r.url.query["q"]);
+    e.Prepare(r.url.query["q"], r.url.query["limit"], r.url.query["cursor"]);
     r(e);
   });
 
@@ -674,31 +1740,59 @@ int main(int argc, char** argv) {
   // If a given EID can be found in the database, it's a user event, otherwise it's a tick event.
   // "raw" is to be internally listened to, it is not exposed over HTTP.
   auto raw = sherlock::Stream<EID>("raw");
-  HTTP(FLAGS_port).Register(FLAGS_route + "ok", [](Request r) { r("OK\n"); });
-
-  // "db" is a structured Yoda storage of processed events, sessions, and so on.
-  // "db" is exposed via HTTP.
-  DB db("db");
+  RegisterTimed(HTTP(FLAGS_port), FLAGS_route + "ok", [](Request r) { r("OK\n"); });
 
   // Expose events, without timestamps, under "/log" for subscriptions, and under "/e" for browsing.
   db.ExposeViaHTTP(FLAGS_port, FLAGS_route + "log");
-  HTTP(FLAGS_port).Register(FLAGS_route + "e", [&db](Request r) {
+  RegisterTimed(HTTP(FLAGS_port), FLAGS_route + "e", [&db](Request r) {
     db.GetWithNext(static_cast<EID>(FromString<uint64_t>(r.url.query["eid"])), std::move(r));
   });
 
+  if (FLAGS_search_substrings) {
+    Singleton<SearchIndex>().EnableSubstringSearch();
+  }
+
   Listener listener(db);
+  if (!FLAGS_session_store_dir.empty()) {
+    try {
+      listener.splitter.session_store.reset(
+          new SessionStore<AggregatedSessionInfo>(FLAGS_session_store_dir, FLAGS_session_segment_size));
+    } catch (const std::runtime_error& e) {
+      std::cerr << e.what() << std::endl;
+      return -1;
+    }
+  }
+  if (checkpoints) {
+    try {
+      checkpoints->Restore(listener.splitter);
+    } catch (const std::exception& e) {
+      std::cerr << "Can not restore from the checkpoint: " << e.what() << std::endl;
+      return -1;
+    }
+    Checkpoints* const checkpoints_ptr = checkpoints.get();
+    ingestion.batch_published_f =
+        [checkpoints_ptr](size_t published_entries, uint64_t input_offset, uint64_t last_key) {
+          checkpoints_ptr->BatchPublished(published_entries, input_offset, last_key);
+        };
+    listener.splitter.finalized_f = [checkpoints_ptr](const AggregatedSessionInfo& session) {
+      checkpoints_ptr->SessionFinalized(session);
+    };
+    listener.checkpoints = checkpoints_ptr;
+  }
   auto scope = raw.SyncSubscribe(listener);
+  ingestion.processed_entries = &listener.total_processed_entries;
 
   std::atomic_size_t total_stream_entries(0);
   std::atomic_bool done_processing_stdin(false);
   std::atomic_bool graceful_shutdown(false);
 
   if (FLAGS_enable_graceful_shutdown) {
-    HTTP(FLAGS_port).Register(FLAGS_route + "graceful_wait",
-                              [&done_processing_stdin, &total_stream_entries, &listener](Request r) {
+    RegisterTimed(HTTP(FLAGS_port),
+                  FLAGS_route + "graceful_wait",
+                  [&done_processing_stdin, &total_stream_entries, &listener](Request r) {
       while (!done_processing_stdin) {
         const size_t total = total_stream_entries;
-        const size_t processed = listener.total_processed_entries;
+        const size_t processed = listener.total_processed_entries.Get();
         if (total) {
           std::cerr << processed * 100 / total << "% (" << processed << " / " << total
                     << ") entries processed.\n";
@@ -710,28 +1804,32 @@ int main(int argc, char** argv) {
       std::cerr << "All entries from standard input have been successfully processed.\n";
       r("Completed.\n");
     });
-    HTTP(FLAGS_port).Register(FLAGS_route + "graceful_shutdown", [&graceful_shutdown](Request r) {
+    RegisterTimed(HTTP(FLAGS_port), FLAGS_route + "graceful_shutdown", [&graceful_shutdown](Request r) {
       graceful_shutdown = true;
       r("Bye.\n");
     });
   }
 
-  // Read from standard input forever.
+  // Read from standard input forever, or until the end of the input file.
   // The rest of the logic is handled asynchronously, by the corresponding listeners.
   {
-    PROFILER_SCOPE("BlockingParseLogEventsAndInjectIdleEventsFromStandardInput");
+    PROFILER_SCOPE("BlockingParseLogEventsAndInjectIdleEvents");
     total_stream_entries =
-        BlockingParseLogEventsAndInjectIdleEventsFromStandardInput<MidichloriansEvent,
-                                                                   MidichloriansEventWithTimestamp>(
-            raw, db, FLAGS_port, FLAGS_route) +
+        BlockingParseLogEventsAndInjectIdleEvents<MidichloriansEvent, MidichloriansEventWithTimestamp>(
+            std::move(ingestion), raw, db, FLAGS_port, FLAGS_route) +
         1;
   }
 
   if (FLAGS_enable_graceful_shutdown) {
     PROFILER_SCOPE("GracefulShutdown");
-    while (listener.total_processed_entries != total_stream_entries) {
+    while (listener.total_processed_entries.Get() != total_stream_entries) {
       ;  // Spin lock.
     }
+    db.Transaction([&listener](typename DB::T_DATA data) {
+      const LatencyScope latency(Latency("transaction", "graceful_shutdown_drain"));
+      listener.splitter.DrainSessions(data);
+      Singleton<SearchIndex>().Publish();
+    }).Go();
     PROFILER_SCOPE("`done_processing_stdin = true`.");
     done_processing_stdin = true;
     scope.Join();